@@ -0,0 +1,212 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+#include "SpinLock.h"
+#include "ThreadRegistry.h"
+
+/**
+* Node allocation policies for ConcurrentAVLTree. A policy is built with the node's size and alignment and
+* hands out blocks of exactly that shape:
+*   allocate()             an uninitialized block.
+*   deallocate(p)          takes back a block once nothing can reach it (the tree calls it from reclamation).
+*   systemAllocations()    how many times the policy has gone to the global allocator. */
+
+/**
+* One global operator new and delete per node; the behavior before allocation became a policy. */
+class HeapAllocation
+{
+public:
+    HeapAllocation(std::size_t size, std::size_t alignment) :
+        m_size(size),
+        m_alignment(alignment)
+    {
+    }
+
+    HeapAllocation(const HeapAllocation &) = delete;
+    HeapAllocation& operator=(const HeapAllocation &) = delete;
+
+    void* allocate()
+    {
+        auto &counter = m_records[ThreadRegistry::index()].system_allocations;
+        counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+        if (m_alignment > __STDCPP_DEFAULT_NEW_ALIGNMENT__)
+            return ::operator new(m_size, std::align_val_t(m_alignment));
+        return ::operator new(m_size);
+    }
+
+    void deallocate(void *ptr)
+    {
+        if (m_alignment > __STDCPP_DEFAULT_NEW_ALIGNMENT__)
+            ::operator delete(ptr, std::align_val_t(m_alignment));
+        else
+            ::operator delete(ptr);
+    }
+
+    std::uint64_t systemAllocations() const
+    {
+        std::uint64_t total = 0;
+        for (std::size_t i = 0; i < ThreadRegistry::highWater(); ++i)
+            total += m_records[i].system_allocations.load(std::memory_order_relaxed);
+        return total;
+    }
+
+private:
+    struct alignas(64) Record
+    {
+        std::atomic<std::uint64_t> system_allocations{0};
+    };
+
+    std::size_t m_size;
+    std::size_t m_alignment;
+    Record m_records[ThreadRegistry::max_threads];
+};
+
+/**
+* Per-thread slab allocator. Each thread carves blocks out of its own slabs and keeps freed blocks in two
+* magazines of up to magazine_size blocks; a thread that frees more than it allocates (a remover whose
+* reclamation frees nodes other threads inserted) passes full magazines to a shared depot, where a thread
+* that runs dry picks them up before it carves a new slab. Once a workload's live set stops growing, every
+* allocation is served from a magazine and the global allocator is no longer called. Slabs are only
+* returned when the policy is destroyed. */
+class PoolAllocation
+{
+public:
+    static const std::size_t slab_bytes = 64 * 1024;
+    static const std::size_t magazine_size = 64;
+
+    PoolAllocation(std::size_t size, std::size_t alignment) :
+        m_alignment(std::max(alignment, alignof(FreeBlock))),
+        m_stride((std::max(size, sizeof(FreeBlock)) + m_alignment - 1) / m_alignment * m_alignment),
+        m_blocks_per_slab(std::max<std::size_t>(1, slab_bytes / m_stride))
+    {
+    }
+
+    PoolAllocation(const PoolAllocation &) = delete;
+    PoolAllocation& operator=(const PoolAllocation &) = delete;
+
+    ~PoolAllocation()
+    {
+        for (auto &record : m_records)
+            for (auto slab : record.slabs)
+                ::operator delete(slab, std::align_val_t(m_alignment));
+    }
+
+    void* allocate()
+    {
+        auto &record = m_records[ThreadRegistry::index()];
+
+        if (record.loaded.count == 0)
+        {
+            if (record.spare.count != 0) std::swap(record.loaded, record.spare);
+            else if (!takeFromDepot(record.loaded)) return carve(record);
+        }
+
+        auto block = record.loaded.head;
+        record.loaded.head = block->next;
+        record.loaded.count--;
+        return block;
+    }
+
+    void deallocate(void *ptr)
+    {
+        auto &record = m_records[ThreadRegistry::index()];
+
+        if (record.loaded.count == magazine_size)
+        {
+            // keep one full magazine in reserve so a thread freeing and allocating around the boundary stays local
+            if (record.spare.count != 0) giveToDepot(record.spare);
+            record.spare = record.loaded;
+            record.loaded = Magazine();
+        }
+
+        auto block = static_cast<FreeBlock*>(ptr);
+        block->next = record.loaded.head;
+        record.loaded.head = block;
+        record.loaded.count++;
+    }
+
+    std::uint64_t systemAllocations() const
+    {
+        std::uint64_t total = 0;
+        for (std::size_t i = 0; i < ThreadRegistry::highWater(); ++i)
+            total += m_records[i].system_allocations.load(std::memory_order_relaxed);
+        return total;
+    }
+
+private:
+    struct FreeBlock
+    {
+        FreeBlock *next;
+    };
+
+    struct Magazine
+    {
+        FreeBlock *head = nullptr;
+        std::size_t count = 0;
+    };
+
+    struct alignas(64) Record
+    {
+        Magazine loaded;
+        Magazine spare;
+        char *bump = nullptr;
+        std::size_t bump_left = 0;
+        std::vector<void*> slabs;
+        std::atomic<std::uint64_t> system_allocations{0};
+    };
+
+    std::size_t m_alignment;
+    std::size_t m_stride;
+    std::size_t m_blocks_per_slab;
+    Record m_records[ThreadRegistry::max_threads];
+
+    SpinLock m_depot_lock;
+    std::vector<Magazine> m_depot;
+    std::atomic<std::size_t> m_depot_size{0}; // read without the lock so a growing pool skips it
+
+    void* carve(Record &record)
+    {
+        if (record.bump_left == 0)
+        {
+            auto slab = ::operator new(m_stride * m_blocks_per_slab, std::align_val_t(m_alignment));
+            record.slabs.push_back(slab);
+            record.bump = static_cast<char*>(slab);
+            record.bump_left = m_blocks_per_slab;
+            record.system_allocations.store(record.system_allocations.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        }
+
+        auto block = record.bump;
+        record.bump += m_stride;
+        record.bump_left--;
+        return block;
+    }
+
+    bool takeFromDepot(Magazine &magazine)
+    {
+        if (m_depot_size.load(std::memory_order_relaxed) == 0) return false;
+
+        std::lock_guard<SpinLock> lock(m_depot_lock);
+        if (m_depot.empty()) return false;
+
+        magazine = m_depot.back();
+        m_depot.pop_back();
+        m_depot_size.store(m_depot.size(), std::memory_order_relaxed);
+        return true;
+    }
+
+    void giveToDepot(const Magazine &magazine)
+    {
+        std::lock_guard<SpinLock> lock(m_depot_lock);
+        m_depot.push_back(magazine);
+        m_depot_size.store(m_depot.size(), std::memory_order_relaxed);
+    }
+};
@@ -51,7 +51,7 @@ protected:
     {
         if (!root) return false;
         if (root->data == data) return true;
-        return (containsRecursive(root->left, data) || containsRecursive(root->right, data));
+        return containsRecursive(data < root->data ? root->left : root->right, data);
     }
 
     void printRecursive(BSTNode<T> *root) const
@@ -163,7 +163,7 @@ private:
 
         	    // remove and store min value from right subtree
         	    auto min = Tree<T>::findMin(right)->data;
-        	    removeRecursive(right, min);
+        	    right = removeRecursive(right, min);
 
         	    // create replacement node centered around min value
         	    root = new BSTNode<T>(min);
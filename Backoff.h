@@ -0,0 +1,111 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+
+#include "ThreadRegistry.h"
+
+// a hint to the core that this is a spin-wait loop
+inline void cpuRelax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+/**
+* Backoff policies: how a thread waits before it retries after finding a lock or a node held up by another
+* thread. A policy is a small state object that one retry loop keeps; wait() is called once per failed
+* attempt, so the wait can grow with the attempts made so far.
+*   YieldBackoff        (default) std::this_thread::yield() every time: the original behaviour, a syscall per
+*                       attempt.
+*   SpinBackoff         one short burst of pause instructions every time; never enters the kernel, so a
+*                       waiter whose lock holder is descheduled spins out its time slice.
+*   ExponentialBackoff  pause bursts that double per attempt, each of a random length between half and
+*                       all of the current limit so waiters spread out; past max_spins it yields as well.
+*   ParkingBackoff      spins like ExponentialBackoff for a budget of attempts, then parks the thread in
+*                       timed sleeps that double up to max_park, giving its core to whoever it waits for. */
+class YieldBackoff
+{
+public:
+    void wait()
+    {
+        std::this_thread::yield();
+    }
+};
+
+class SpinBackoff
+{
+public:
+    void wait()
+    {
+        for (unsigned i = 0; i < spins; ++i)
+            cpuRelax();
+    }
+
+private:
+    static constexpr unsigned spins = 16;
+};
+
+class ExponentialBackoff
+{
+public:
+    void wait()
+    {
+        spin(m_limit);
+        if (m_limit < max_spins) m_limit *= 2;
+        else std::this_thread::yield();
+    }
+
+protected:
+    static constexpr unsigned initial_spins = 4;
+    static constexpr unsigned max_spins = 1024;
+
+    unsigned m_limit = initial_spins;
+
+    static void spin(unsigned limit)
+    {
+        for (unsigned i = limit / 2 + jitter() % (limit / 2 + 1); i > 0; --i)
+            cpuRelax();
+    }
+
+    // xorshift32, one stream per thread
+    static std::uint32_t jitter()
+    {
+        thread_local std::uint32_t state = 0x9e3779b9u * std::uint32_t(ThreadRegistry::index() + 1);
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+};
+
+class ParkingBackoff : ExponentialBackoff
+{
+public:
+    void wait()
+    {
+        if (m_attempts < spin_budget)
+        {
+            ++m_attempts;
+            spin(m_limit);
+            m_limit = std::min(m_limit * 2, max_spins);
+            return;
+        }
+
+        std::this_thread::sleep_for(m_park);
+        m_park = std::min(m_park * 2, max_park);
+    }
+
+private:
+    static constexpr unsigned spin_budget = 8;
+    static constexpr std::chrono::microseconds first_park{2};
+    static constexpr std::chrono::microseconds max_park{256};
+
+    unsigned m_attempts = 0;
+    std::chrono::microseconds m_park = first_park;
+};
@@ -0,0 +1,1330 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <unistd.h>
+
+#include "ContentionStats.h"
+#include "LatencyHistogram.h"
+#include "PerfCounters.h"
+
+/**
+* Configurable throughput harness for the tree benchmarks. A configuration is a key range, an
+* insert/remove/contains mix and a list of thread counts; every (tree, thread count) pair is measured over
+* a number of runs on a freshly prefilled tree, after some discarded warm-up runs, and reported as the mean
+* and sample standard deviation of ops/sec. Workloads are drawn from the seed alone, so two invocations
+* with the same options replay the same operations.
+*
+* Keys follow one of these distributions:
+*   uniform     every key in [0, range) equally likely.
+*   zipf        key popularity falls off as 1 / rank^theta; ranks are scattered over the range so hot keys
+*               are not also adjacent.
+*   hotspot     hot_ops of the operations go to the lowest hot_keys of the range, the rest to the remainder.
+*   sequential  inserts take ascending ids (monotonic across threads, wrapping at the range), so they all
+*               land on the rightmost path; removes and lookups stay uniform.
+*   window      inserts take ascending ids above the live window and removes retire the oldest ids below
+*               it, so the prefilled block slides up the range; lookups hit the current window. Equal insert
+*               and remove percentages keep the window size constant.
+*   walk        each thread's keys take short random steps from a random start, so most land next to the
+*               thread's previous one.
+*
+* A mode decides what each operation of the mix does:
+*   set         inserts, removes and lookups, as drawn.
+*   update      inserts and removes both become an update of the key: a tree that has update(key) changes the
+*               key's entry in place, any other removes the key and, if it was there, inserts it again.
+*   nearest     lookups become floor(key), the greatest key not above it.
+*   scan        lookups become range(key, key + batch - 1), visiting each key in it; one scan counts as one
+*               operation.
+*   hint        inserts and lookups go through a hint each thread keeps for the whole run (insert(hint, key)
+*               and find(hint, key)), removes through plain remove. As long as a hint lives it holds a
+*               reclamation guard, so under EpochReclamation nothing removed in the run is freed before it ends.
+*   batch       operations collect in per-thread buffers of each kind, which go to insertBatch or
+*               removeBatch, sorted, and to containsMany once batch keys have come in; whatever is left goes
+*               when the thread finishes. Operation latencies then mostly time the buffering, and the
+*               flushes land on the operations that fill a buffer.
+*   queue       a scheduler's hold model, whatever the mix: every operation pops the least key, with the
+*               spray given, and inserts one whose priority is key + 1 above the popped one's. Priorities
+*               climb by about range / (2 * queued keys) per operation; a run that would take them past
+*               2^25, where the keys outgrow int, stops with std::overflow_error instead.
+* Modes and fill methods need trees that have their operations, and trees without the set operations run
+* only the queue mode; any other combination is skipped.
+*
+* The prefill goes in one of these ways, timed and reported as fill_seconds:
+*   insert      one insert per key, in random order (the default).
+*   ascending   one insert per key, in key order, the sorted keys split into a contiguous share per thread.
+*   batch       one insertBatch of the sorted keys.
+*   build       buildFromSorted of the sorted keys, on as many threads as the configuration has.
+*
+* With latency recording on, every operation is also timed into a per-thread histogram per operation kind;
+* those are merged over the threads and measured runs of a configuration and reported as percentiles. With
+* counters on, every thread reads its hardware counters over the timed phase, and the sums are reported per
+* operation. */
+
+enum FNS
+{
+    ADD,
+    REMOVE,
+    CONTAINS
+};
+
+enum KeyDistribution
+{
+    UNIFORM,
+    ZIPFIAN,
+    HOTSPOT,
+    SEQUENTIAL,
+    MOVING_WINDOW,
+    WALK
+};
+
+const char* const key_distribution_names[] = {"uniform", "zipf", "hotspot", "sequential", "window", "walk"};
+
+// the largest step of the walk distribution
+const int walk_step = 4;
+
+enum BenchmarkMode
+{
+    SET_MODE,
+    UPDATE_MODE,
+    NEAREST_MODE,
+    SCAN_MODE,
+    HINT_MODE,
+    BATCH_MODE,
+    QUEUE_MODE
+};
+
+const char* const benchmark_mode_names[] = {"set", "update", "nearest", "scan", "hint", "batch", "queue"};
+
+enum FillMethod
+{
+    INSERT_FILL,
+    ASCENDING_FILL,
+    BATCH_FILL,
+    BUILD_FILL,
+    SNAPSHOT_FILL
+};
+
+const char* const fill_method_names[] = {"insert", "ascending", "batch", "build", "snapshot"};
+
+struct BenchmarkOptions
+{
+    int insert_percent = 33;
+    int remove_percent = 33;
+    int contains_percent = 34;
+    int key_range = 1 << 16;
+    double prefill = 0.5;           // fraction of the key range inserted before each run
+    FillMethod fill = INSERT_FILL;
+    long num_ops = 1 << 20;         // per run, split across the threads; ignored when duration is set
+    double duration = 0;            // seconds per run, 0 to run num_ops instead
+    int num_runs = 5;
+    int num_warmup_runs = 1;
+    std::uint64_t seed = 1;
+    std::vector<KeyDistribution> distributions = {UNIFORM};
+    std::vector<BenchmarkMode> modes = {SET_MODE};
+    int batch = 64;                 // keys a scan covers, or a batch holds
+    int spray = 1;                  // queue: pops take a random one of this many least keys
+    double zipf_theta = 0.99;
+    double hot_keys = 0.2;          // fraction of the range that is hot
+    double hot_ops = 0.8;           // fraction of the operations that go to it
+    std::vector<int> thread_counts = {1, 2, 4, 8, 16, 32};
+    std::vector<std::string> trees = {"sequential", "concurrent"};
+    std::vector<std::string> policies = {"default"};
+    long budget = 64;               // deferred policy: rebalancing fixes left pending before updates apply them
+    bool maintain = false;          // deferred policy: apply pending fixes on a thread of its own during each run
+    double purge_ratio = 0.25;      // tombstone policy: share of the nodes tombstones may make up, 0 to never purge
+    bool latency = false;
+    bool counters = false;          // hardware counters per operation, where perf_event_open allows them
+    bool shape = false;             // average depth and cache lines per search of the tree after the last run
+    std::string snapshot_path;      // each run saves the tree here alongside the workload, or loads its prefill with --fill snapshot
+    std::string csv_path;
+    std::string json_path;
+};
+
+typedef std::vector<std::pair<std::string, double>> BenchmarkNotes;
+
+struct BenchmarkResult
+{
+    KeyDistribution distribution;
+    BenchmarkMode mode;
+    std::string tree;
+    int num_threads;
+    double ops_per_sec;
+    double stddev;
+    std::vector<double> samples;
+    std::array<LatencyHistogram, 3> latency;    // indexed by FNS, empty unless latency is recorded
+    ContentionSnapshot contention;              // summed over the measured runs of trees built with ContentionStats
+    std::int64_t system_allocations;            // global allocator calls by the node allocator in the measured runs, -1 if not known
+    BenchmarkNotes notes;                       // figures only some trees or options have, such as the node size
+};
+
+const char* const fns_names[] = {"insert", "remove", "contains"};
+
+const double latency_percentiles[] = {0.5, 0.99, 0.999};
+const char* const latency_percentile_names[] = {"p50", "p99", "p999"};
+
+// the low bits of a queue mode key that keep keys of the same priority apart
+const int queue_sequence_bits = 6;
+
+// a duration run cycles through this many precomputed operations per thread rather than drawing keys while timed
+const std::size_t max_stream_length = 1 << 16;
+
+// the tree names Main.cpp knows how to instantiate
+const char* const benchmark_trees[] = {"sequential", "concurrent", "lockfree", "concurrent_stats", "lockfree_stats",
+                                       "concurrent_heap", "lockfree_heap", "sequential_bst", "concurrent_bst", "lockfree_bst",
+                                       "concurrent_combining", "lockfree_combining", "map", "priority_queue"};
+
+// the policies Main.cpp can swap into the concurrent and lockfree trees, one at a time; "default" leaves them as they are
+const char* const benchmark_policies[] = {"default", "hazard", "no_reclamation", "holder_mutex", "cacheline", "split",
+                                         "deferred", "tombstone", "spin_backoff", "exponential_backoff", "parking_backoff"};
+
+struct BenchmarkOp
+{
+    FNS fn;
+    int key;
+};
+
+inline const char* benchmarkUsage()
+{
+    return
+        "usage: bst [options]\n"
+        "       bst <insert%> <remove%> <contains%>\n"
+        "  --mix I,R,C         insert/remove/contains percentages, summing to 100 (default 33,33,34)\n"
+        "  --range N           keys are drawn from [0, N) (default 65536)\n"
+        "  --prefill F         fraction of the range inserted before each run (default 0.5)\n"
+        "  --fill METHOD       how the prefill goes in, timed: insert (random order), ascending (split across the\n"
+        "                      threads), batch (insertBatch), build (buildFromSorted on the threads), snapshot\n"
+        "                      (loadSnapshot of the --snapshot file on the threads) (default insert)\n"
+        "  --ops N             operations per run, split across threads (default 1048576)\n"
+        "  --duration S        run for S seconds instead of a fixed operation count\n"
+        "  --runs N            measured runs per configuration (default 5)\n"
+        "  --warmup N          discarded runs before measuring (default 1)\n"
+        "  --threads A,B,...   thread counts to measure (default 1,2,4,8,16,32)\n"
+        "  --trees A,B,...     any of sequential, concurrent, lockfree (default sequential,concurrent);\n"
+        "                      concurrent_stats and lockfree_stats also count contention events;\n"
+        "                      concurrent_heap and lockfree_heap allocate each node from the global heap;\n"
+        "                      sequential_bst, concurrent_bst and lockfree_bst are the unbalanced variants;\n"
+        "                      concurrent_combining and lockfree_combining put flat combining in front (opt-in);\n"
+        "                      map is ConcurrentAVLMap, updating a key's value in place;\n"
+        "                      priority_queue is a locked std::priority_queue, for the queue mode only\n"
+        "  --policies A,B,...  measure concurrent and lockfree once per policy, each swapped in for the tree's own:\n"
+        "                      default (none swapped), hazard, no_reclamation, holder_mutex, cacheline, split,\n"
+        "                      deferred, tombstone (concurrent only), spin_backoff, exponential_backoff,\n"
+        "                      parking_backoff (default default)\n"
+        "  --budget N          deferred: rebalancing fixes left pending before updates apply them (default 64)\n"
+        "  --maintain          deferred: apply pending fixes on a background thread while the workload runs\n"
+        "  --purge-ratio R     tombstone: share of the nodes tombstones may make up before a purge, 0 for never\n"
+        "                      (default 0.25)\n"
+        "  --dist A,B,...      key distributions: uniform, zipf, hotspot, sequential, window, walk (default uniform)\n"
+        "  --mode A,B,...      what the operations do: set, update, nearest, scan, hint, batch, queue (default set)\n"
+        "  --batch N           scan and batch: keys each scan covers and each batch holds (default 64)\n"
+        "  --spray N           queue: pops take a random one of the N least keys (default 1)\n"
+        "  --theta T           zipf skew, 0 for uniform (default 0.99)\n"
+        "  --hot-keys F        hotspot: fraction of the range that is hot (default 0.2)\n"
+        "  --hot-ops F         hotspot: fraction of operations on hot keys (default 0.8)\n"
+        "  --seed N            workload seed (default 1)\n"
+        "  --latency           also record per-operation latency percentiles (adds two clock reads per operation)\n"
+        "  --counters          also report hardware counters per operation, where perf_event_open allows them\n"
+        "  --shape             also report the average depth and cache lines per search of the final tree\n"
+        "  --snapshot PATH     save the tree to PATH once per run, while the threads work on it; with --fill snapshot,\n"
+        "                      the prefill is written there once instead and each run loads it\n"
+        "  --csv PATH          write results as CSV (read by Results/ResultVisualizer.py)\n"
+        "  --json PATH         write results as JSON (read by Results/ResultVisualizer.py)\n";
+}
+
+inline std::vector<std::string> splitList(const std::string &list)
+{
+    std::vector<std::string> items;
+    std::stringstream stream(list);
+    std::string item;
+
+    while (std::getline(stream, item, ','))
+        if (!item.empty()) items.push_back(item);
+
+    return items;
+}
+
+inline long parseInteger(const std::string &option, const std::string &value)
+{
+    std::size_t used = 0;
+    long result = 0;
+
+    try { result = std::stol(value, &used); }
+    catch (const std::exception &) { used = 0; }
+
+    if (used == 0 || used != value.size())
+        throw std::invalid_argument(option + " expects an integer, got '" + value + "'");
+    return result;
+}
+
+inline double parseReal(const std::string &option, const std::string &value)
+{
+    std::size_t used = 0;
+    double result = 0;
+
+    try { result = std::stod(value, &used); }
+    catch (const std::exception &) { used = 0; }
+
+    if (used == 0 || used != value.size())
+        throw std::invalid_argument(option + " expects a number, got '" + value + "'");
+    return result;
+}
+
+/**
+* Parses the harness options; throws std::invalid_argument on anything malformed or out of range.
+* Three bare percentages are still accepted as the mix, as the original demo took them. */
+inline BenchmarkOptions parseBenchmarkOptions(int argc, char **argv)
+{
+    BenchmarkOptions options;
+    std::vector<std::string> args(argv + 1, argv + argc);
+
+    auto setMix = [&options](const std::string &option, const std::vector<std::string> &parts) {
+        if (parts.size() != 3)
+            throw std::invalid_argument(option + " expects three percentages");
+        options.insert_percent = parseInteger(option, parts[0]);
+        options.remove_percent = parseInteger(option, parts[1]);
+        options.contains_percent = parseInteger(option, parts[2]);
+    };
+
+    if (args.size() == 3 && args[0].compare(0, 2, "--") != 0)
+    {
+        setMix("mix", args);
+        args.clear();
+    }
+
+    for (std::size_t i = 0; i < args.size(); ++i)
+    {
+        auto &option = args[i];
+        if (option == "--latency" || option == "--counters" || option == "--shape" || option == "--maintain")
+        {
+            auto &flag = option == "--latency" ? options.latency : option == "--counters" ? options.counters :
+                         option == "--shape" ? options.shape : options.maintain;
+            flag = true;
+            continue;
+        }
+
+        if (i + 1 == args.size())
+            throw std::invalid_argument(option + " expects a value");
+        auto &value = args[++i];
+
+        if (option == "--mix") setMix(option, splitList(value));
+        else if (option == "--range") options.key_range = parseInteger(option, value);
+        else if (option == "--prefill") options.prefill = parseReal(option, value);
+        else if (option == "--ops") options.num_ops = parseInteger(option, value);
+        else if (option == "--duration") options.duration = parseReal(option, value);
+        else if (option == "--runs") options.num_runs = parseInteger(option, value);
+        else if (option == "--warmup") options.num_warmup_runs = parseInteger(option, value);
+        else if (option == "--seed") options.seed = parseInteger(option, value);
+        else if (option == "--batch") options.batch = parseInteger(option, value);
+        else if (option == "--spray") options.spray = parseInteger(option, value);
+        else if (option == "--budget") options.budget = parseInteger(option, value);
+        else if (option == "--purge-ratio") options.purge_ratio = parseReal(option, value);
+        else if (option == "--csv") options.csv_path = value;
+        else if (option == "--json") options.json_path = value;
+        else if (option == "--snapshot") options.snapshot_path = value;
+        else if (option == "--trees") options.trees = splitList(value);
+        else if (option == "--policies") options.policies = splitList(value);
+        else if (option == "--theta") options.zipf_theta = parseReal(option, value);
+        else if (option == "--hot-keys") options.hot_keys = parseReal(option, value);
+        else if (option == "--hot-ops") options.hot_ops = parseReal(option, value);
+        else if (option == "--dist")
+        {
+            options.distributions.clear();
+            for (auto &name : splitList(value))
+            {
+                auto found = std::find(std::begin(key_distribution_names), std::end(key_distribution_names), name);
+                if (found == std::end(key_distribution_names))
+                    throw std::invalid_argument("unknown distribution " + name);
+                options.distributions.push_back(KeyDistribution(found - std::begin(key_distribution_names)));
+            }
+        }
+        else if (option == "--fill")
+        {
+            auto found = std::find(std::begin(fill_method_names), std::end(fill_method_names), value);
+            if (found == std::end(fill_method_names))
+                throw std::invalid_argument("unknown fill method " + value);
+            options.fill = FillMethod(found - std::begin(fill_method_names));
+        }
+        else if (option == "--mode")
+        {
+            options.modes.clear();
+            for (auto &name : splitList(value))
+            {
+                auto found = std::find(std::begin(benchmark_mode_names), std::end(benchmark_mode_names), name);
+                if (found == std::end(benchmark_mode_names))
+                    throw std::invalid_argument("unknown mode " + name);
+                options.modes.push_back(BenchmarkMode(found - std::begin(benchmark_mode_names)));
+            }
+        }
+        else if (option == "--threads")
+        {
+            options.thread_counts.clear();
+            for (auto &count : splitList(value))
+                options.thread_counts.push_back(parseInteger(option, count));
+        }
+        else throw std::invalid_argument("unknown option " + option);
+    }
+
+    if (options.insert_percent < 0 || options.remove_percent < 0 || options.contains_percent < 0 ||
+        options.insert_percent + options.remove_percent + options.contains_percent != 100)
+        throw std::invalid_argument("the mix must be three non-negative percentages summing to 100");
+    if (options.key_range < 1)
+        throw std::invalid_argument("--range must be positive");
+    if (options.prefill < 0 || options.prefill > 1)
+        throw std::invalid_argument("--prefill must be in [0, 1]");
+    if (options.num_ops < 1 || options.duration < 0 || options.num_runs < 1 || options.num_warmup_runs < 0)
+        throw std::invalid_argument("--ops and --runs must be positive, --duration and --warmup non-negative");
+    if (options.batch < 1 || options.spray < 1)
+        throw std::invalid_argument("--batch and --spray must be positive");
+    if (options.budget < 0 || options.purge_ratio < 0)
+        throw std::invalid_argument("--budget and --purge-ratio must be non-negative");
+    if (options.zipf_theta < 0)
+        throw std::invalid_argument("--theta must be non-negative");
+    if (options.hot_keys < 0 || options.hot_keys > 1 || options.hot_ops < 0 || options.hot_ops > 1)
+        throw std::invalid_argument("--hot-keys and --hot-ops must be in [0, 1]");
+    if (options.thread_counts.empty() || options.trees.empty() || options.policies.empty() || options.distributions.empty() ||
+        options.modes.empty())
+        throw std::invalid_argument("--threads, --trees, --policies, --dist and --mode must not be empty");
+    for (auto &tree : options.trees)
+        if (std::find(std::begin(benchmark_trees), std::end(benchmark_trees), tree) == std::end(benchmark_trees))
+            throw std::invalid_argument("unknown tree " + tree);
+    for (auto &policy : options.policies)
+        if (std::find(std::begin(benchmark_policies), std::end(benchmark_policies), policy) == std::end(benchmark_policies))
+            throw std::invalid_argument("unknown policy " + policy);
+    for (auto count : options.thread_counts)
+        if (count < 1 || count >= 128)
+            throw std::invalid_argument("thread counts must be in [1, 128)");
+    if (options.fill == SNAPSHOT_FILL && options.snapshot_path.empty())
+        throw std::invalid_argument("--fill snapshot needs a --snapshot file");
+
+    return options;
+}
+
+/**
+* Holds the operations every run of one configuration replays: the shuffled prefill keys and one
+* operation stream per thread, each drawn from its own generator seeded with (seed, thread). Ascending
+* distributions give thread t of T the ids congruent to t mod T, and record per operation kind how far
+* the keys move each time the stream is replayed from the start. */
+class BenchmarkWorkload
+{
+public:
+    typedef std::array<int, 3> Drift;
+
+    BenchmarkWorkload(const BenchmarkOptions &options, KeyDistribution distribution, int num_threads) :
+        _streams(num_threads),
+        _drifts(num_threads)
+    {
+        auto range = options.key_range;
+        int prefill_count = static_cast<int>(options.prefill * range);
+        bool ascending = distribution == SEQUENTIAL || distribution == MOVING_WINDOW;
+
+        // ascending distributions start from the lowest block so new ids always land above it
+        std::mt19937_64 prefill_generator(options.seed);
+        std::vector<int> keys(range);
+        for (int i = 0; i < range; ++i)
+            keys[i] = i;
+        if (ascending)
+        {
+            keys.resize(prefill_count);
+            std::shuffle(keys.begin(), keys.end(), prefill_generator);
+        }
+        else
+        {
+            std::shuffle(keys.begin(), keys.end(), prefill_generator);
+            keys.resize(prefill_count);
+        }
+        _prefill_keys = std::move(keys);
+        if (options.fill != INSERT_FILL)
+        {
+            _sorted_prefill_keys = _prefill_keys;
+            std::sort(_sorted_prefill_keys.begin(), _sorted_prefill_keys.end());
+        }
+
+        std::vector<double> zipf_cdf;
+        std::vector<int> zipf_keys;
+        if (distribution == ZIPFIAN)
+        {
+            zipf_cdf.resize(range);
+            double total = 0;
+            for (int rank = 0; rank < range; ++rank)
+                zipf_cdf[rank] = total += std::pow(rank + 1.0, -options.zipf_theta);
+            for (auto &p : zipf_cdf)
+                p /= total;
+
+            // a generator of its own so the hot keys are not simply the first ones prefilled
+            std::mt19937_64 scatter_generator(options.seed + 1);
+            zipf_keys.resize(range);
+            for (int i = 0; i < range; ++i)
+                zipf_keys[i] = i;
+            std::shuffle(zipf_keys.begin(), zipf_keys.end(), scatter_generator);
+        }
+
+        int hot_count = std::min(std::max(static_cast<int>(options.hot_keys * range), 1), range);
+
+        for (int t = 0; t < num_threads; ++t)
+        {
+            // the remainder of an uneven split goes to the lowest threads so exactly num_ops run
+            std::size_t length = options.num_ops / num_threads + (t < options.num_ops % num_threads ? 1 : 0);
+            if (options.duration > 0 || length > max_stream_length)
+                length = max_stream_length;
+
+            std::seed_seq seed{options.seed, static_cast<std::uint64_t>(t)};
+            std::mt19937_64 generator(seed);
+            std::uniform_int_distribution<int> percent(0, 99);
+            std::uniform_int_distribution<int> key(0, range - 1);
+            std::uniform_real_distribution<double> unit(0.0, 1.0);
+            std::int64_t inserted = 0, removed = 0;
+            int walked = key(generator);
+
+            auto ascendingId = [&](std::int64_t base, std::int64_t n) {
+                return static_cast<int>((base + n * num_threads + t) % range);
+            };
+
+            auto &stream = _streams[t];
+            stream.reserve(length);
+            for (std::size_t i = 0; i < length; ++i)
+            {
+                auto r = percent(generator);
+                auto fn = r < options.insert_percent ? FNS::ADD :
+                          r < options.insert_percent + options.remove_percent ? FNS::REMOVE : FNS::CONTAINS;
+
+                int k = 0;
+                switch (distribution)
+                {
+                    case UNIFORM:
+                        k = key(generator);
+                        break;
+                    case ZIPFIAN:
+                    {
+                        auto rank = std::upper_bound(zipf_cdf.begin(), zipf_cdf.end(), unit(generator)) - zipf_cdf.begin();
+                        k = zipf_keys[std::min<std::ptrdiff_t>(rank, range - 1)];
+                        break;
+                    }
+                    case HOTSPOT:
+                        if (hot_count == range || unit(generator) < options.hot_ops)
+                            k = std::uniform_int_distribution<int>(0, hot_count - 1)(generator);
+                        else
+                            k = std::uniform_int_distribution<int>(hot_count, range - 1)(generator);
+                        break;
+                    case SEQUENTIAL:
+                        k = fn == FNS::ADD ? ascendingId(prefill_count, inserted++) : key(generator);
+                        break;
+                    case MOVING_WINDOW:
+                        if (fn == FNS::ADD) k = ascendingId(prefill_count, inserted++);
+                        else if (fn == FNS::REMOVE) k = ascendingId(0, removed++);
+                        else k = static_cast<int>((removed * num_threads + generator() % std::max(prefill_count, 1)) % range);
+                        break;
+                    case WALK:
+                        walked = std::min(std::max(walked + int(generator() % (2 * walk_step + 1)) - walk_step, 0), range - 1);
+                        k = walked;
+                        break;
+                }
+
+                stream.push_back(BenchmarkOp{fn, k});
+            }
+
+            auto insert_drift = static_cast<int>(inserted * num_threads % range);
+            auto remove_drift = static_cast<int>(removed * num_threads % range);
+            _drifts[t] = Drift{{insert_drift, remove_drift, remove_drift}};
+        }
+    }
+
+    const std::vector<int>& prefillKeys() const { return _prefill_keys; }
+    const std::vector<int>& sortedPrefillKeys() const { return _sorted_prefill_keys; }
+    const std::vector<BenchmarkOp>& stream(int thread) const { return _streams[thread]; }
+    const Drift& drift(int thread) const { return _drifts[thread]; }
+
+private:
+    std::vector<int> _prefill_keys;
+    std::vector<int> _sorted_prefill_keys;     // only for fill methods that take the keys in order
+    std::vector<std::vector<BenchmarkOp>> _streams;
+    std::vector<Drift> _drifts;
+};
+
+/**
+* Walks one thread's stream, starting over when it runs out. Every restart shifts the keys of each
+* operation kind by that kind's drift, so ascending workloads keep ascending instead of replaying. */
+class StreamCursor
+{
+public:
+    StreamCursor(const BenchmarkWorkload &workload, int thread, int key_range) :
+        _stream(workload.stream(thread)),
+        _drift(workload.drift(thread)),
+        _key_range(key_range)
+    {
+    }
+
+    BenchmarkOp next()
+    {
+        // widened so ranges above 2^30 cannot overflow the sum
+        auto op = _stream[_index];
+        auto key = std::int64_t(op.key) + _offset[op.fn];
+        op.key = static_cast<int>(key >= _key_range ? key - _key_range : key);
+
+        if (++_index == _stream.size())
+        {
+            _index = 0;
+            for (int fn = 0; fn < 3; ++fn)
+                _offset[fn] = static_cast<int>((std::int64_t(_offset[fn]) + _drift[fn]) % _key_range);
+        }
+
+        return op;
+    }
+
+private:
+    const std::vector<BenchmarkOp> &_stream;
+    const BenchmarkWorkload::Drift &_drift;
+    int _key_range;
+    std::size_t _index = 0;
+    int _offset[3] = {0, 0, 0};
+};
+
+// trees built with a stats policy add their counters to the total; anything else leaves it alone
+template<typename Tree>
+inline auto collectContention(const Tree &tree, ContentionSnapshot &total, int) -> decltype(tree.stats(), void())
+{
+    total += tree.stats();
+}
+
+template<typename Tree>
+inline void collectContention(const Tree &, ContentionSnapshot &, long)
+{
+}
+
+// trees with a node allocator policy add its global allocator calls to the count; anything else leaves it alone
+template<typename Tree>
+inline auto collectAllocations(const Tree &tree, std::int64_t &count, int) -> decltype(tree.systemAllocations(), void())
+{
+    count += tree.systemAllocations();
+}
+
+template<typename Tree>
+inline void collectAllocations(const Tree &, std::int64_t &, long)
+{
+}
+
+template<typename Tree>
+constexpr auto countsAllocations(int) -> decltype(std::declval<const Tree&>().systemAllocations(), bool())
+{
+    return true;
+}
+
+template<typename Tree>
+constexpr bool countsAllocations(long)
+{
+    return false;
+}
+
+// resident set size of this process in kilobytes, read from /proc (Linux only)
+inline long residentKilobytes()
+{
+    long total_pages = 0, resident_pages = 0;
+    std::ifstream statm("/proc/self/statm");
+    statm >> total_pages >> resident_pages;
+    return resident_pages * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+// trees that know their node size note it
+template<typename Tree>
+inline auto noteNodeSize(BenchmarkNotes &notes, int) -> decltype(Tree::nodeSize(), void())
+{
+    notes.emplace_back("node_bytes", Tree::nodeSize());
+}
+
+template<typename Tree>
+inline void noteNodeSize(BenchmarkNotes &, long)
+{
+}
+
+// trees that can trace a search note how deep their keys sit on average and how many cache lines reaching one takes
+template<typename Tree>
+inline auto noteShape(const Tree &tree, BenchmarkNotes &notes, int) -> decltype(tree.depth(0), tree.cacheLinesTouched(0), void())
+{
+    std::size_t keys = 0, depth = 0, lines = 0;
+    for (auto &key : tree)
+    {
+        ++keys;
+        depth += tree.depth(key);
+        lines += tree.cacheLinesTouched(key);
+    }
+    notes.emplace_back("depth", double(depth) / std::max<std::size_t>(keys, 1));
+    notes.emplace_back("lines_per_search", double(lines) / std::max<std::size_t>(keys, 1));
+}
+
+template<typename Tree>
+inline void noteShape(const Tree &, BenchmarkNotes &, long)
+{
+}
+
+template<typename Tree>
+inline void applyOp(Tree &tree, const BenchmarkOp &op)
+{
+    switch (op.fn)
+    {
+        case FNS::ADD:      tree.insert(op.key); break;
+        case FNS::REMOVE:   tree.remove(op.key); break;
+        case FNS::CONTAINS: tree.contains(op.key); break;
+    }
+}
+
+// the sequential trees' remove does not say whether the key was there, so they are asked first
+template<typename Tree>
+inline auto reinsertKey(Tree &tree, int key, int) -> decltype(bool(tree.remove(key)), void())
+{
+    if (tree.remove(key)) tree.insert(key);
+}
+
+template<typename Tree>
+inline void reinsertKey(Tree &tree, int key, long)
+{
+    if (!tree.contains(key)) return;
+    tree.remove(key);
+    tree.insert(key);
+}
+
+// trees that can change a key's entry in place do so; anything else takes the key out and puts it back
+template<typename Tree>
+inline auto updateKey(Tree &tree, int key, int) -> decltype(tree.update(key), void())
+{
+    tree.update(key);
+}
+
+template<typename Tree>
+inline void updateKey(Tree &tree, int key, long)
+{
+    reinsertKey(tree, key, 0);
+}
+
+template<typename Tree>
+constexpr auto hasSetOps(int) -> decltype(std::declval<Tree&>().remove(0), std::declval<const Tree&>().contains(0), bool())
+{
+    return true;
+}
+
+template<typename Tree>
+constexpr bool hasSetOps(long)
+{
+    return false;
+}
+
+template<typename Tree>
+constexpr auto hasQueue(int) -> decltype(std::declval<Tree&>().popMin(std::declval<int&>(), std::size_t(1)), bool())
+{
+    return true;
+}
+
+template<typename Tree>
+constexpr bool hasQueue(long)
+{
+    return false;
+}
+
+template<typename Tree>
+constexpr auto hasHint(int) -> decltype(std::declval<Tree&>().hint(), bool())
+{
+    return true;
+}
+
+template<typename Tree>
+constexpr bool hasHint(long)
+{
+    return false;
+}
+
+template<typename Tree>
+constexpr auto hasBatch(int) -> decltype(std::declval<Tree&>().insertBatch(std::declval<int*>(), std::declval<int*>()),
+                                         std::declval<Tree&>().removeBatch(std::declval<int*>(), std::declval<int*>()),
+                                         std::declval<const Tree&>().containsMany(std::declval<const int*>(), std::size_t(0),
+                                                                                  std::declval<bool*>()), bool())
+{
+    return true;
+}
+
+template<typename Tree>
+constexpr bool hasBatch(long)
+{
+    return false;
+}
+
+template<typename Tree>
+constexpr auto hasNearest(int) -> decltype(std::declval<Tree&>().floor(0, std::declval<int&>()), bool())
+{
+    return true;
+}
+
+template<typename Tree>
+constexpr bool hasNearest(long)
+{
+    return false;
+}
+
+template<typename Tree>
+constexpr auto hasScan(int) -> decltype(std::declval<const Tree&>().range(0, 0, std::declval<void (*)(int)>()), bool())
+{
+    return true;
+}
+
+template<typename Tree>
+constexpr bool hasScan(long)
+{
+    return false;
+}
+
+template<typename Tree>
+constexpr auto hasBuild(int) -> decltype(std::declval<Tree&>().buildFromSorted(std::declval<const int*>(), std::declval<const int*>(), 1u), bool())
+{
+    return true;
+}
+
+template<typename Tree>
+constexpr bool hasBuild(long)
+{
+    return false;
+}
+
+template<typename Tree>
+constexpr auto hasSnapshot(int) -> decltype(std::declval<const Tree&>().saveSnapshot(std::string()),
+                                            std::declval<Tree&>().loadSnapshot(std::string(), 1u), bool())
+{
+    return true;
+}
+
+template<typename Tree>
+constexpr bool hasSnapshot(long)
+{
+    return false;
+}
+
+/**
+* Fills an empty tree with the workload's prefill keys the way the options say, on num_threads threads where
+* the method uses more than one; benchmarkSupports has ruled out methods the tree lacks.
+* @return the seconds it took. */
+template<typename Tree>
+double fillTree(Tree &tree, const BenchmarkOptions &options, const BenchmarkWorkload &workload, int num_threads)
+{
+    auto &sorted = workload.sortedPrefillKeys();
+    auto start_time = std::chrono::steady_clock::now();
+    switch (options.fill)
+    {
+        case INSERT_FILL:
+            for (auto key : workload.prefillKeys())
+                tree.insert(key);
+            break;
+        case ASCENDING_FILL:
+        {
+            std::vector<std::thread> threads;
+            for (int t = 0; t < num_threads; ++t)
+                threads.emplace_back([&, t]() {
+                    for (auto i = sorted.size() * t / num_threads; i < sorted.size() * (t + 1) / num_threads; ++i)
+                        tree.insert(sorted[i]);
+                });
+            for (auto &thread : threads)
+                thread.join();
+            break;
+        }
+        case BATCH_FILL:
+            if constexpr (hasBatch<Tree>(0)) tree.insertBatch(sorted.data(), sorted.data() + sorted.size());
+            break;
+        case BUILD_FILL:
+            if constexpr (hasBuild<Tree>(0)) tree.buildFromSorted(sorted.data(), sorted.data() + sorted.size(), num_threads);
+            break;
+        case SNAPSHOT_FILL:
+            if constexpr (hasSnapshot<Tree>(0)) tree.loadSnapshot(options.snapshot_path, num_threads);
+            break;
+    }
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+}
+
+// whether Tree has the operations the mode, the fill method and any snapshot need
+template<typename Tree>
+bool benchmarkSupports(const BenchmarkOptions &options, BenchmarkMode mode)
+{
+    auto fill = options.fill;
+    if (fill == BATCH_FILL ? !hasBatch<Tree>(0) : fill == BUILD_FILL ? !hasBuild<Tree>(0) : false)
+        return false;
+    if (!options.snapshot_path.empty() && !hasSnapshot<Tree>(0))
+        return false;
+    return mode == QUEUE_MODE ? hasQueue<Tree>(0) :
+           !hasSetOps<Tree>(0) ? false :
+           mode == NEAREST_MODE ? hasNearest<Tree>(0) :
+           mode == SCAN_MODE ? hasScan<Tree>(0) :
+           mode == HINT_MODE ? hasHint<Tree>(0) :
+           mode == BATCH_MODE ? hasBatch<Tree>(0) : true;
+}
+
+/**
+* Calls body(apply, finish) on the calling thread, where apply(op) carries out one operation as the mode
+* has it and finish() completes anything apply left pending. Whatever state a mode keeps per thread lives
+* here, so it is set up before body starts the clock. */
+template<typename Tree, typename Body>
+void runSession(Tree &tree, const BenchmarkOptions &options, BenchmarkMode mode, Body body)
+{
+    auto nothing = [] {};
+    // a queue key is its priority above queue_sequence_bits of sequence, so that pushes of one priority rarely collide
+    std::uint32_t sequence = 0;
+    if constexpr (hasQueue<Tree>(0))
+        if (mode == QUEUE_MODE)
+            return body([&](const BenchmarkOp &op) {
+                int least;
+                if (!tree.popMin(least, options.spray)) return;
+                // widened, since the priorities only ever climb; see the queue mode above
+                auto key = ((std::int64_t(least) >> queue_sequence_bits) + 1 + op.key) << queue_sequence_bits |
+                           (sequence++ & ((1 << queue_sequence_bits) - 1));
+                for (;; ++key)
+                {
+                    if (key > std::numeric_limits<int>::max())
+                        throw std::overflow_error("queue mode: the priorities outgrew int; raise --prefill or lower --ops");
+                    if (tree.insert(int(key))) break;
+                }
+            }, nothing);
+
+    // benchmarkSupports keeps trees without the set operations to the queue mode
+    if constexpr (hasSetOps<Tree>(0))
+    {
+        if constexpr (hasNearest<Tree>(0))
+            if (mode == NEAREST_MODE)
+                return body([&](const BenchmarkOp &op) {
+                    int result;
+                    if (op.fn == FNS::CONTAINS) tree.floor(op.key, result);
+                    else applyOp(tree, op);
+                }, nothing);
+
+        if constexpr (hasScan<Tree>(0))
+            if (mode == SCAN_MODE)
+                return body([&](const BenchmarkOp &op) {
+                    if (op.fn == FNS::CONTAINS) tree.range(op.key, op.key + options.batch - 1, [](int) {});
+                    else applyOp(tree, op);
+                }, nothing);
+
+        if constexpr (hasHint<Tree>(0))
+            if (mode == HINT_MODE)
+            {
+                auto hint = tree.hint();
+                return body([&](const BenchmarkOp &op) {
+                    switch (op.fn)
+                    {
+                        case FNS::ADD:      tree.insert(hint, op.key); break;
+                        case FNS::REMOVE:   tree.remove(op.key); break;
+                        case FNS::CONTAINS: tree.find(hint, op.key); break;
+                    }
+                }, nothing);
+            }
+
+        if constexpr (hasBatch<Tree>(0))
+            if (mode == BATCH_MODE)
+            {
+                std::vector<int> pending[3];    // indexed by FNS
+                std::unique_ptr<bool[]> found(new bool[options.batch]);
+                auto flush = [&](int fn) {
+                    auto &keys = pending[fn];
+                    if (fn == FNS::CONTAINS)
+                        tree.containsMany(keys.data(), keys.size(), found.get());
+                    else
+                    {
+                        std::sort(keys.begin(), keys.end());
+                        if (fn == FNS::ADD) tree.insertBatch(keys.data(), keys.data() + keys.size());
+                        else tree.removeBatch(keys.data(), keys.data() + keys.size());
+                    }
+                    keys.clear();
+                };
+
+                return body([&](const BenchmarkOp &op) {
+                    pending[op.fn].push_back(op.key);
+                    if (pending[op.fn].size() == std::size_t(options.batch)) flush(op.fn);
+                }, [&] {
+                    for (int fn = 0; fn < 3; ++fn)
+                        flush(fn);
+                });
+            }
+
+        if (mode == UPDATE_MODE)
+            body([&](const BenchmarkOp &op) {
+                if (op.fn == FNS::CONTAINS) tree.contains(op.key);
+                else updateKey(tree, op.key, 0);
+            }, nothing);
+        else
+            body([&](const BenchmarkOp &op) { applyOp(tree, op); }, nothing);
+    }
+}
+
+/**
+* What runBenchmark does to trees that need more than a default-constructed tree: prepare runs on each
+* filled tree before the clock starts, settle on each tree once it stops, and report on the last measured
+* run's tree, after its shape is noted, to add notes of its own. These hooks do nothing. */
+struct NoBenchmarkHooks
+{
+    template<typename Tree>
+    void prepare(Tree &) const {}
+
+    template<typename Tree>
+    void settle(Tree &) const {}
+
+    template<typename Tree>
+    void report(Tree &, BenchmarkNotes &) const {}
+};
+
+/**
+* One run on a fresh, prefilled tree. All threads are started and parked before the clock starts, so
+* thread creation is not timed. In a fixed-count run each thread executes num_ops / num_threads
+* operations (replaying its stream when that is longer than max_stream_length), each through its session of
+* the mode; in a duration run they replay until told to stop. An operation that throws stops the run, and
+* the exception is rethrown once every thread has finished. When latency is given, each thread's histograms are merged into it at the end;
+* when contention or allocations is, the tree's counters for the timed phase are added to it. When counters is
+* given, every hardware counter summed over the threads is added to it per operation, and when notes is, the
+* resident set size, the hooks' report, and the shape of the tree if the options ask for it, are noted there
+* after the run. When saved is given, one more thread saves the tree to the
+* snapshot file as the clock starts, and the seconds it took and the keys it wrote are added to it.
+* @return ops/sec over the run. */
+template<typename Tree, typename Hooks>
+double runBenchmarkOnce(const BenchmarkOptions &options, const BenchmarkWorkload &workload, BenchmarkMode mode, int num_threads,
+                        const Hooks &hooks, std::array<LatencyHistogram, 3> *latency = NULL, ContentionSnapshot *contention = NULL,
+                        std::int64_t *allocations = NULL, std::array<double, PERF_EVENT_COUNT> *counters = NULL,
+                        BenchmarkNotes *notes = NULL, double *fill_seconds = NULL, std::array<double, 2> *saved = NULL)
+{
+    Tree tree;
+    auto filled = fillTree(tree, options, workload, num_threads);
+    if (fill_seconds) *fill_seconds += filled;
+    hooks.prepare(tree);
+
+    // the prefill's own rotations are not part of the measurement
+    ContentionSnapshot before;
+    collectContention(tree, before, 0);
+    std::int64_t allocations_before = 0;
+    collectAllocations(tree, allocations_before, 0);
+
+    std::atomic<int> ready{0};
+    std::atomic<bool> go{false};
+    std::atomic<bool> stop{false};
+    std::vector<long> completed(num_threads, 0);
+    std::vector<std::array<LatencyHistogram, 3>> thread_latency(latency ? num_threads : 0);
+    std::vector<std::array<std::uint64_t, PERF_EVENT_COUNT>> thread_counters(num_threads);
+    std::vector<std::thread> threads;
+    std::exception_ptr failure;
+    std::atomic_flag failing = ATOMIC_FLAG_INIT;
+
+    for (int t = 0; t < num_threads; ++t)
+    {
+        threads.emplace_back([&, t]() {
+            StreamCursor cursor(workload, t, options.key_range);
+            long target = options.num_ops / num_threads + (t < options.num_ops % num_threads ? 1 : 0);
+            long done = 0;
+
+            // opened before the start line, since perf_event_open is a system call per event
+            PerfCounters perf;
+            try
+            {
+                runSession(tree, options, mode, [&](auto apply, auto finish) {
+                    auto step = [&]() {
+                        auto op = cursor.next();
+                        if (!latency)
+                        {
+                            apply(op);
+                            return;
+                        }
+
+                        auto begin = std::chrono::steady_clock::now();
+                        apply(op);
+                        auto elapsed = std::chrono::steady_clock::now() - begin;
+                        thread_latency[t][op.fn].record(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+                    };
+
+                    ready.fetch_add(1);
+                    while (!go.load(std::memory_order_acquire))
+                        std::this_thread::yield();
+
+                    if (counters) perf.start();
+                    if (options.duration > 0)
+                    {
+                        for (; !stop.load(std::memory_order_relaxed); ++done)
+                            step();
+                    }
+                    else
+                    {
+                        for (; done < target; ++done)
+                            step();
+                    }
+                    finish();
+                    if (counters) perf.stop();
+                });
+            }
+            catch (...)
+            {
+                if (!failing.test_and_set()) failure = std::current_exception();
+                stop.store(true, std::memory_order_relaxed);
+            }
+
+            completed[t] = done;
+            for (int e = 0; e < PERF_EVENT_COUNT; ++e)
+                thread_counters[t][e] = perf.value(static_cast<PerfEvent>(e));
+        });
+    }
+
+    // not one of the workers, so neither its time nor its keys count towards ops/sec
+    std::thread saver;
+    if constexpr (hasSnapshot<Tree>(0))
+        if (saved)
+            saver = std::thread([&]() {
+                while (!go.load(std::memory_order_acquire))
+                    std::this_thread::yield();
+
+                auto begin = std::chrono::steady_clock::now();
+                (*saved)[1] += tree.saveSnapshot(options.snapshot_path);
+                (*saved)[0] += std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+            });
+
+    while (ready.load() < num_threads)
+        std::this_thread::yield();
+
+    auto start_time = std::chrono::steady_clock::now();
+    go.store(true, std::memory_order_release);
+
+    if (options.duration > 0)
+    {
+        std::this_thread::sleep_for(std::chrono::duration<double>(options.duration));
+        stop.store(true, std::memory_order_relaxed);
+    }
+
+    for (auto &thread : threads)
+        thread.join();
+
+    auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+    if (saver.joinable())
+        saver.join();
+    if (failure)
+        std::rethrow_exception(failure);
+    hooks.settle(tree);
+
+    long total = 0;
+    for (auto done : completed)
+        total += done;
+
+    for (auto &histograms : thread_latency)
+        for (int fn = 0; fn < 3; ++fn)
+            (*latency)[fn].merge(histograms[fn]);
+
+    for (int e = 0; counters && e < PERF_EVENT_COUNT; ++e)
+    {
+        std::uint64_t sum = 0;
+        for (auto &values : thread_counters)
+            sum += values[e];
+        (*counters)[e] += double(sum) / total;
+    }
+    // read while the tree, and whatever it has not reclaimed, is still alive; it covers the whole process all the same
+    if (notes && countsAllocations<Tree>(0))
+        notes->emplace_back("rss_kb", residentKilobytes());
+    if (notes && options.shape)
+        noteShape(tree, *notes, 0);
+    if (notes)
+        hooks.report(tree, *notes);
+
+    if (contention)
+    {
+        ContentionSnapshot after;
+        collectContention(tree, after, 0);
+        for (std::size_t e = 0; e < CONTENTION_EVENT_COUNT; ++e)
+            contention->counts[e] += after.counts[e] - before.counts[e];
+    }
+    if (allocations)
+    {
+        std::int64_t allocations_after = 0;
+        collectAllocations(tree, allocations_after, 0);
+        *allocations += allocations_after - allocations_before;
+    }
+    return total / seconds;
+}
+
+/**
+* Runs the warm-up and measured runs of one (distribution, mode, tree, thread count) configuration, with hooks
+* applied to every run's tree (see NoBenchmarkHooks); for a mode the tree does not support, it runs nothing and
+* returns no samples. */
+template<typename Tree, typename Hooks = NoBenchmarkHooks>
+BenchmarkResult runBenchmark(const std::string &name, const BenchmarkOptions &options, KeyDistribution distribution,
+                             BenchmarkMode mode, int num_threads, const Hooks &hooks = Hooks())
+{
+    BenchmarkResult result{distribution, mode, name, num_threads, 0, 0, {}, {}, {}, 0};
+    if (!benchmarkSupports<Tree>(options, mode))
+        return result;
+
+    BenchmarkWorkload workload(options, distribution, num_threads);
+    if constexpr (hasSnapshot<Tree>(0))
+        if (options.fill == SNAPSHOT_FILL)
+        {
+            auto &sorted = workload.sortedPrefillKeys();
+            Tree source;
+            source.buildFromSorted(sorted.data(), sorted.data() + sorted.size(), num_threads);
+            source.saveSnapshot(options.snapshot_path);
+        }
+
+    for (int r = 0; r < options.num_warmup_runs; ++r)
+        runBenchmarkOnce<Tree>(options, workload, mode, num_threads, hooks);
+
+    noteNodeSize<Tree>(result.notes, 0);
+    std::array<double, PERF_EVENT_COUNT> counters{};
+    double fill_seconds = 0;
+    std::array<double, 2> saved{};
+    bool saves = !options.snapshot_path.empty() && options.fill != SNAPSHOT_FILL;
+    for (int r = 0; r < options.num_runs; ++r)
+        result.samples.push_back(runBenchmarkOnce<Tree>(options, workload, mode, num_threads, hooks, options.latency ? &result.latency : NULL,
+                                                        &result.contention, &result.system_allocations,
+                                                        options.counters ? &counters : NULL,
+                                                        r == options.num_runs - 1 ? &result.notes : NULL,
+                                                        &fill_seconds, saves ? &saved : NULL));
+    if (!countsAllocations<Tree>(0)) result.system_allocations = -1;
+    result.notes.emplace_back("fill_seconds", fill_seconds / options.num_runs);
+
+    if (!options.snapshot_path.empty())
+    {
+        std::ifstream file(options.snapshot_path, std::ios::binary | std::ios::ate);
+        if (saves)
+        {
+            result.notes.emplace_back("save_seconds", saved[0] / options.num_runs);
+            result.notes.emplace_back("keys_saved", saved[1] / options.num_runs);
+        }
+        result.notes.emplace_back("file_bytes", static_cast<double>(file.tellg()));
+        std::remove(options.snapshot_path.c_str());
+    }
+
+    // a probe on this thread tells which events the workers could open
+    PerfCounters probe;
+    for (int e = 0; options.counters && e < PERF_EVENT_COUNT; ++e)
+        if (probe.available(static_cast<PerfEvent>(e)))
+            result.notes.emplace_back(std::string(perf_event_names[e]) + "_per_op", counters[e] / options.num_runs);
+
+    for (auto sample : result.samples)
+        result.ops_per_sec += sample;
+    result.ops_per_sec /= result.samples.size();
+
+    if (result.samples.size() > 1)
+    {
+        for (auto sample : result.samples)
+            result.stddev += (sample - result.ops_per_sec) * (sample - result.ops_per_sec);
+        result.stddev = std::sqrt(result.stddev / (result.samples.size() - 1));
+    }
+
+    return result;
+}
+
+inline void writeBenchmarkCsv(const std::string &path, const BenchmarkOptions &options, const std::vector<BenchmarkResult> &results)
+{
+    std::ofstream out(path);
+    out.precision(12);
+    out << "distribution,mode,tree,threads,insert,remove,contains,range,prefill,theta,hot_keys,hot_ops,ops,duration,runs,seed,"
+           "ops_per_sec,stddev";
+    for (auto fn : fns_names)
+    {
+        for (auto percentile : latency_percentile_names)
+            out << "," << fn << "_" << percentile << "_ns";
+        out << "," << fn << "_max_ns";
+    }
+    out << ",system_allocations\n";
+
+    for (auto &result : results)
+    {
+        out << key_distribution_names[result.distribution] << "," << benchmark_mode_names[result.mode] << "," << result.tree << "," << result.num_threads << ","
+            << options.insert_percent << "," << options.remove_percent << "," << options.contains_percent << ","
+            << options.key_range << "," << options.prefill << "," << options.zipf_theta << ","
+            << options.hot_keys << "," << options.hot_ops << "," << options.num_ops << "," << options.duration << ","
+            << options.num_runs << "," << options.seed << "," << result.ops_per_sec << "," << result.stddev;
+
+        // latency columns stay empty for operation kinds that were not recorded
+        for (auto &histogram : result.latency)
+        {
+            for (auto q : latency_percentiles)
+                out << "," << (histogram.count() ? std::to_string(histogram.percentile(q)) : "");
+            out << "," << (histogram.count() ? std::to_string(histogram.max()) : "");
+        }
+        out << "," << (result.system_allocations >= 0 ? std::to_string(result.system_allocations) : "") << "\n";
+    }
+
+    if (!out)
+        throw std::runtime_error("could not write " + path);
+}
+
+inline void writeBenchmarkJson(const std::string &path, const BenchmarkOptions &options, const std::vector<BenchmarkResult> &results)
+{
+    std::ofstream out(path);
+    out.precision(12);
+    out << "{\n  \"config\": {\"insert\": " << options.insert_percent
+        << ", \"remove\": " << options.remove_percent
+        << ", \"contains\": " << options.contains_percent
+        << ", \"range\": " << options.key_range
+        << ", \"prefill\": " << options.prefill
+        << ", \"theta\": " << options.zipf_theta
+        << ", \"hot_keys\": " << options.hot_keys
+        << ", \"hot_ops\": " << options.hot_ops
+        << ", \"ops\": " << options.num_ops
+        << ", \"duration\": " << options.duration
+        << ", \"runs\": " << options.num_runs
+        << ", \"warmup\": " << options.num_warmup_runs
+        << ", \"seed\": " << options.seed
+        << ", \"latency\": " << (options.latency ? "true" : "false") << "},\n  \"results\": [";
+
+    for (std::size_t i = 0; i < results.size(); ++i)
+    {
+        auto &result = results[i];
+        out << (i ? ",\n" : "\n") << "    {\"distribution\": \"" << key_distribution_names[result.distribution]
+            << "\", \"mode\": \"" << benchmark_mode_names[result.mode] << "\", \"tree\": \"" << result.tree << "\", \"threads\": " << result.num_threads
+            << ", \"ops_per_sec\": " << result.ops_per_sec << ", \"stddev\": " << result.stddev << ", \"samples\": [";
+        for (std::size_t s = 0; s < result.samples.size(); ++s)
+            out << (s ? ", " : "") << result.samples[s];
+        out << "]";
+
+        if (options.latency)
+        {
+            out << ", \"latency_ns\": {";
+            for (int fn = 0; fn < 3; ++fn)
+            {
+                auto &histogram = result.latency[fn];
+                out << (fn ? ", " : "") << "\"" << fns_names[fn] << "\": {\"count\": " << histogram.count();
+                for (int q = 0; q < 3; ++q)
+                    out << ", \"" << latency_percentile_names[q] << "\": " << histogram.percentile(latency_percentiles[q]);
+                out << ", \"max\": " << histogram.max() << "}";
+            }
+            out << "}";
+        }
+
+        // only trees built with ContentionStats count anything
+        if (!result.contention.empty())
+        {
+            out << ", \"contention\": {";
+            for (std::size_t e = 0; e < CONTENTION_EVENT_COUNT; ++e)
+                out << (e ? ", " : "") << "\"" << contention_event_names[e] << "\": " << result.contention.counts[e];
+            out << "}";
+        }
+
+        if (result.system_allocations >= 0)
+            out << ", \"system_allocations\": " << result.system_allocations;
+
+        if (!result.notes.empty())
+        {
+            out << ", \"notes\": {";
+            for (std::size_t n = 0; n < result.notes.size(); ++n)
+                out << (n ? ", " : "") << "\"" << result.notes[n].first << "\": " << result.notes[n].second;
+            out << "}";
+        }
+
+        out << "}";
+    }
+
+    out << "\n  ]\n}\n";
+
+    if (!out)
+        throw std::runtime_error("could not write " + path);
+}
@@ -0,0 +1,194 @@
+#pragma once
+
+#include <functional>
+#include <mutex>
+
+#include "ConcurrentBST.h"
+
+/**
+* Ordered key/value map on top of ConcurrentAVLTree. Each tree element is an Entry ordered by its key and
+* carrying the value next to a lock of its own, so get, put on an existing key and computeIfPresent find
+* the node like contains does and then hold only that entry's lock: no succ_lock, tree_lock or rebalance.
+*
+* Only insertions of new keys and erase go through the tree's insert and remove. erase first marks the
+* entry deleted under its lock, which is where it takes effect; readers and writers treat a deleted entry
+* as absent, and a put that finds one waits, paced by Backoff, for the eraser to take the node out before
+* inserting anew. Under TombstoneRemoval that insert may revive the erased node, entry and all; see insert.
+* K and V must be copyable and default constructible. The other parameters are ConcurrentAVLTree's. */
+template<typename K, typename V, typename Reclaimer = EpochReclamation, typename Lock = SpinLock, typename Ordering = LockedOrdering,
+         typename Stats = NoStats, typename Layout = PackedLayout, typename Allocator = PoolAllocation,
+         typename Compare = std::less<K>, typename Balancing = AVLBalancing, typename Removal = UnlinkRemoval,
+         typename Backoff = YieldBackoff>
+class ConcurrentAVLMap
+{
+    struct Entry
+    {
+        K key;
+        mutable Lock lock;
+        mutable bool deleted = false;
+        mutable V value;
+
+        Entry() = default;
+        explicit Entry(const K &key) : key(key), value() {}
+        Entry(const K &key, const V &value) : key(key), value(value) {}
+
+        // a copy gets a fresh lock. The tree copies entries out of nodes others may be changing (to search for
+        // them again later under DeferredBalancing and TombstoneRemoval), so a copy holds the source's lock.
+        Entry(const Entry &other)
+        {
+            *this = other;
+        }
+
+        Entry& operator=(const Entry &other)
+        {
+            lockWith<Backoff>(other.lock);
+            std::lock_guard<Lock> lock(other.lock, std::adopt_lock);
+            key = other.key;
+            deleted = other.deleted;
+            value = other.value;
+            return *this;
+        }
+    };
+
+    struct EntryLess
+    {
+        Compare less;
+
+        bool operator()(const Entry &a, const Entry &b) const
+        {
+            return less(a.key, b.key);
+        }
+    };
+
+    typedef ConcurrentAVLTree<Entry, Reclaimer, Lock, Ordering, Stats, Layout, Allocator, EntryLess, Balancing, Removal,
+                              Backoff> Tree;
+
+public:
+    /**
+    * @return true and value set to the key's value, or false if the key is absent. */
+    bool get(const K &key, V &value) const
+    {
+        return apply(key, [&](V &current) { value = current; }) == PRESENT;
+    }
+
+    bool contains(const K &key) const
+    {
+        return apply(key, [](V &) {}) == PRESENT;
+    }
+
+    /**
+    * Sets the key's value, inserting the key if it is absent.
+    * @return true if the key was inserted, false if an existing value was replaced. */
+    bool put(const K &key, const V &value)
+    {
+        Backoff backoff;
+        while (true)
+        {
+            auto state = apply(key, [&](V &current) { current = value; });
+            if (state == PRESENT) return false;
+            if (state == ERASING) backoff.wait();
+            else if (insert(key, value)) return true;
+        }
+    }
+
+    /**
+    * Inserts the key with value unless it is present.
+    * @return true iff the key was inserted. */
+    bool putIfAbsent(const K &key, const V &value)
+    {
+        Backoff backoff;
+        while (true)
+        {
+            auto state = apply(key, [](V &) {});
+            if (state == PRESENT) return false;
+            if (state == ERASING) backoff.wait();
+            else if (insert(key, value)) return true;
+        }
+    }
+
+    /**
+    * Calls fn(value) with the key's value, which fn may change in place, while holding the entry's lock.
+    * @return true iff the key was present. */
+    template<typename Function>
+    bool computeIfPresent(const K &key, Function fn)
+    {
+        return apply(key, fn) == PRESENT;
+    }
+
+    /**
+    * @return true iff the key was present and is now removed. */
+    bool erase(const K &key)
+    {
+        bool erased = false;
+        _tree.visit(Entry(key), [&](const Entry &entry) {
+            lockWith<Backoff>(entry.lock);
+            std::lock_guard<Lock> lock(entry.lock, std::adopt_lock);
+            if (entry.deleted) return;
+            entry.deleted = true;
+            erased = true;
+        });
+
+        // nobody can insert the key while the deleted node is in the tree, so this removes exactly that node
+        if (erased) _tree.remove(Entry(key));
+        return erased;
+    }
+
+    ContentionSnapshot stats() const
+    {
+        return _tree.stats();
+    }
+
+    std::uint64_t systemAllocations() const
+    {
+        return _tree.systemAllocations();
+    }
+
+private:
+    enum State
+    {
+        PRESENT,
+        ERASING,    // marked deleted, node not yet out of the tree
+        ABSENT
+    };
+
+    Tree _tree;
+
+    /**
+    * Calls fn with a present key's value under its entry lock. */
+    template<typename Function>
+    State apply(const K &key, Function &&fn) const
+    {
+        auto state = ABSENT;
+        _tree.visit(Entry(key), [&](const Entry &entry) {
+            lockWith<Backoff>(entry.lock);
+            std::lock_guard<Lock> lock(entry.lock, std::adopt_lock);
+            state = entry.deleted ? ERASING : PRESENT;
+            if (state == PRESENT) fn(entry.value);
+        });
+        return state;
+    }
+
+    /**
+    * Inserts a new entry for key unless the tree holds one. Under TombstoneRemoval the tree's insert may
+    * instead revive the node an erase left behind, whose entry is still the erased one. So the entry goes
+    * in marked deleted, which keeps everyone else off it as if it were being erased whichever node it ends
+    * up in, and is given its value and made present once it is in. */
+    bool insert(const K &key, const V &value)
+    {
+        if constexpr (!Removal::leaves_tombstones) return _tree.insert(Entry(key, value));
+        else
+        {
+            Entry entry(key, value);
+            entry.deleted = true;
+            if (!_tree.insert(entry)) return false;
+
+            _tree.visit(entry, [&](const Entry &member) {
+                lockWith<Backoff>(member.lock);
+                std::lock_guard<Lock> lock(member.lock, std::adopt_lock);
+                member.value = value;
+                member.deleted = false;
+            });
+            return true;
+        }
+    }
+};
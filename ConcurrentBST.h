@@ -1,321 +1,2346 @@
 
+#pragma once
+
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
 #include <iostream>
 #include <thread>
 #include <mutex>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+#include "Allocation.h"
+#include "Backoff.h"
+#include "ContentionStats.h"
+#include "HolderMutex.h"
+#include "PendingFixes.h"
+#include "Reclamation.h"
+#include "Snapshot.h"
+#include "SpinLock.h"
+#include "Tombstones.h"
+
+/**
+* Ordering layer engines. LockedOrdering keeps the pred/succ list under per-node succ_locks.
+* LockFreeOrdering updates it Harris-style with CAS on succ links, whose low bit marks a node as
+* logically removed; only the physical AVL layout still takes tree_locks. */
+struct LockedOrdering
+{
+    static const bool lock_free = false;
+};
+
+struct LockFreeOrdering
+{
+    static const bool lock_free = true;
+};
+
+/**
+* Balancing engines. AVLBalancing and NoBalancing are the two variants of the paper. AVLBalancing keeps each
+* node's subtree heights and restores the AVL invariant with rotations after every insert and remove.
+* NoBalancing is the unbalanced BST: the same logical ordering and the same physical unlinking, but no
+* heights and no rotations, so an insert locks only the new node's parent and a remove only the nodes it
+* relinks. Its depth then depends on the order keys arrive in, which suits randomly keyed workloads and not
+* ascending ones.
+* DeferredBalancing updates like NoBalancing and leaves the heights and rotations to maintenance: each
+* update logs the node whose heights it made stale (see PendingFixes.h), and maintain(), a background
+* thread (startMaintenance) or the updating threads themselves, once they have left setImbalanceBudget's
+* number of fixes pending, bring those heights up to date and rotate as AVLBalancing would have. Until
+* then the tree may be out of balance by about that many fixes per thread. */
+struct AVLBalancing
+{
+    static const bool rebalances = true;
+    static const bool deferred = false;
+};
+
+struct NoBalancing
+{
+    static const bool rebalances = false;
+    static const bool deferred = false;
+};
+
+struct DeferredBalancing
+{
+    static const bool rebalances = false;
+    static const bool deferred = true;
+};
+
+/**
+* Node layouts. All of them put the fields searches and list walks read first (data, valid, deleted and
+* the heights packed into data's padding, then left, right, succ, pred) and the ones only writers touch last (parent,
+* locks); for int keys a node is then 56 bytes, which malloc serves from 64-byte chunks.
+*   PackedLayout     (default) no alignment beyond the fields' own. Pooled nodes sit 56 bytes apart, so
+*                    the search fields of one in four straddle two lines; the density still pays off.
+*   CacheLineLayout  nodes start on a cache line, so the search fields are always in a single line.
+*   SplitLayout      also moves parent and the locks to the node's second line, so taking a tree_lock does
+*                    not invalidate the line searches read. Twice the memory.
+* Under HeapAllocation the aligned layouts go through aligned operator new, which glibc serves with gaps
+* between nodes; run `./bst --trees concurrent --policies default,cacheline,split --shape --counters` to compare
+* them on a given machine. */
+struct PackedLayout
+{
+    static const std::size_t node_alignment = alignof(void*);
+    static const std::size_t cold_alignment = alignof(void*);
+};
+
+struct CacheLineLayout
+{
+    static const std::size_t node_alignment = 64;
+    static const std::size_t cold_alignment = alignof(void*);
+};
+
+struct SplitLayout
+{
+    static const std::size_t node_alignment = 64;
+    static const std::size_t cold_alignment = 64;
+};
+
+/**
+* Lock needs lock/try_lock/unlock plus owns_lock(), which the rebalancing unlock paths rely on. It is
+* never acquired recursively, so the compact SpinLock is the default; HolderMutex still fits.
+* Stats is NoStats or ContentionStats (see ContentionStats.h); stats() returns its snapshot.
+* Allocator is PoolAllocation or HeapAllocation (see Allocation.h).
+* Compare is a strict weak order on T. The sentinels bounding the key space are told apart by address,
+* never by their keys, so every T is a valid key; T has to be default constructible to fill them.
+* Balancing is AVLBalancing, NoBalancing or DeferredBalancing; ConcurrentBST below names the unbalanced tree.
+* Removal is UnlinkRemoval or, under LockedOrdering, TombstoneRemoval (see Tombstones.h).
+* Backoff decides how retry loops, and waits for a SpinLock, pace themselves (see Backoff.h). */
+template<typename T, typename Reclaimer = EpochReclamation, typename Lock = SpinLock, typename Ordering = LockedOrdering,
+         typename Stats = NoStats, typename Layout = PackedLayout, typename Allocator = PoolAllocation,
+         typename Compare = std::less<T>, typename Balancing = AVLBalancing, typename Removal = UnlinkRemoval,
+         typename Backoff = YieldBackoff>
+class ConcurrentAVLTree
+{
+    static_assert(!Removal::leaves_tombstones || !Ordering::lock_free, "a lock-free removal mark cannot be taken back");
+
+    typedef typename Reclaimer::Guard Guard;
+
+    // integers go by value and compare with plain operators; anything else by reference through Compare
+    static const bool integral_keys = std::is_integral<T>::value && std::is_same<Compare, std::less<T>>::value;
+    typedef typename std::conditional<std::is_scalar<T>::value, T, const T&>::type Key;
+
+    // hazard slots used within one operation's guard; see Reclamation.h
+    enum HazardSlot
+    {
+        SEARCH_A,
+        SEARCH_B,
+        WALK_A,
+        WALK_B,
+        PRED,
+        SUCC_PARENT,
+        LOCK_PARENT,
+        RELOCK,
+        REPLACEMENT,
+        LAST_LESS,
+        CURSOR_A,   // a walk's current node and the two it steps through; see Iterator
+        CURSOR_B,
+        CURSOR_C
+    };
+
+    /**
+    * Memory ordering: links are stored with release and read with acquire wherever a reader may not
+    * hold the lock that guards them (search, the pred/succ walks, lockParent), so a node's fields are
+    * visible before any path to it is. Reads made while holding the guarding lock are relaxed, as are
+    * the heights, which are only touched under tree_locks.
+    *
+    * Under LockFreeOrdering succ carries the removal mark and pred is left as set at insertion. Under
+    * TombstoneRemoval deleted marks a node removed but still linked; it is written under the succ_lock
+    * of the node's predecessor. */
+    template<typename G>
+    struct alignas(std::max(Layout::node_alignment, alignof(G))) ConcurrentNode
+    {
+        // read by searches and list walks; the heights fill what would otherwise be padding after data
+        const G data; // immutable
+        std::atomic<bool> valid;
+        std::atomic<bool> deleted;
+        std::atomic<std::int8_t> left_tree_height;
+        std::atomic<std::int8_t> right_tree_height;
+        std::atomic<ConcurrentNode<G>*> left;
+        std::atomic<ConcurrentNode<G>*> right;
+        std::atomic<ConcurrentNode<G>*> succ;
+        std::atomic<ConcurrentNode<G>*> pred;
+
+        // touched by writers only
+        alignas(Layout::cold_alignment) std::atomic<ConcurrentNode<G>*> parent;
+
+        Lock tree_lock;
+        Lock succ_lock;
+
+        ConcurrentNode(const G data, ConcurrentNode<G> *pred, ConcurrentNode<G> *succ, ConcurrentNode<G> *parent) :
+            data(data),
+            valid(true),
+            deleted(false),
+            left_tree_height(0),
+            right_tree_height(0),
+            left(NULL),
+            right(NULL),
+            succ(succ),
+            pred(pred),
+            parent(parent)
+        {
+        }
+    };
+
+public:
+    ConcurrentAVLTree() :
+        _allocator(sizeof(ConcurrentNode<T>), alignof(ConcurrentNode<T>))
+    {
+        // -inf and +inf: their keys are never compared, see compareTo
+        _head = createNode(T(), NULL, NULL, NULL);
+        _root = createNode(T(), _head, _head, _head);
+
+        _head->right.store(_root, std::memory_order_release);
+        _head->succ.store(_root, std::memory_order_release);
+    }
+
+    /**
+    * A tree holding the keys in [first, last), built by buildFromSorted. */
+    template<typename RandomIt>
+    ConcurrentAVLTree(RandomIt first, RandomIt last, unsigned threads = 1) :
+        ConcurrentAVLTree()
+    {
+        buildFromSorted(first, last, threads);
+    }
+
+    /**
+    * Fills an empty tree with the keys in [first, last), which must be strictly ascending, without going
+    * through insert: the nodes are laid out as a perfectly balanced tree with their heights and pred/succ
+    * links set as they are created, the two halves of each of the top subtrees built by separate threads
+    * until threads of them run at once. No other operation may run on the tree meanwhile; the tree is
+    * published when it returns.
+    * @throws std::invalid_argument if the tree is not empty or the keys are not strictly ascending. */
+    template<typename RandomIt>
+    void buildFromSorted(RandomIt first, RandomIt last, unsigned threads = 1)
+    {
+        if (_root->left.load(std::memory_order_relaxed))
+            throw std::invalid_argument("buildFromSorted: tree is not empty");
+        if (std::adjacent_find(first, last, [this](Key a, Key b) { return !lessKeys(a, b); }) != last)
+            throw std::invalid_argument("buildFromSorted: keys are not strictly ascending");
+        if (first == last) return;
+
+        threads = std::min<unsigned>(std::max(threads, 1u), ThreadRegistry::max_threads / 2);
+        auto built = buildSorted(first, 0, std::size_t(last - first), threads);
+        built.root->parent.store(_root, std::memory_order_relaxed);
+        built.first->pred.store(_head, std::memory_order_relaxed);
+        built.last->succ.store(_root, std::memory_order_relaxed);
+        _root->pred.store(built.last, std::memory_order_relaxed);
+
+        // release: every node written above, by this thread or the joined builders, before either way in
+        _root->left.store(built.root, std::memory_order_release);
+        _head->succ.store(built.first, std::memory_order_release);
+        if constexpr (Removal::leaves_tombstones) _removal.addNodes(std::int64_t(last - first));
+    }
+
+    /**
+    * Writes the keys to path as a snapshot (see Snapshot.h), replacing the file only once it is complete.
+    * The keys are read off the succ chain with the consistency of an iterator, so writers can carry on;
+    * every snapshot_chunk keys the walk lets go of its guard and seeks back to where it was, so a long
+    * save does not hold up reclamation. T must be trivially copyable.
+    * @return the number of keys written.
+    * @throws std::runtime_error if the file cannot be written. */
+    std::size_t saveSnapshot(const std::string &path) const
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "snapshots store keys as raw bytes");
+
+        SnapshotWriter writer(path, sizeof(T));
+        std::size_t count = 0;
+        T resume_at = T();
+
+        for (bool first_chunk = true; ; first_chunk = false)
+        {
+            Guard guard(_reclaimer);
+            std::size_t slot = CURSOR_A;
+            auto node = first_chunk ? nextMember(_head, guard, slot) : seekForward(resume_at, true, guard, slot);
+
+            for (std::size_t i = 0; i < snapshot_chunk && node != _root; ++i, node = nextMember(node, guard, slot))
+            {
+                writer.append(&node->data);
+                ++count;
+            }
+
+            if (node == _root) break;
+            resume_at = node->data;
+        }
+
+        writer.finish(count);
+        return count;
+    }
+
+    /**
+    * Fills an empty tree from a snapshot written by saveSnapshot: the file is mapped and its keys go
+    * straight to buildFromSorted, as does threads.
+    * @return the number of keys loaded.
+    * @throws std::runtime_error if the file cannot be read or is not a snapshot of this key type, and
+    * std::invalid_argument as buildFromSorted does. */
+    std::size_t loadSnapshot(const std::string &path, unsigned threads = 1)
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "snapshots store keys as raw bytes");
+
+        SnapshotFile file(path, sizeof(T));
+        auto keys = static_cast<const T*>(file.keys());
+        buildFromSorted(keys, keys + file.count(), threads);
+        return file.count();
+    }
+
+    ~ConcurrentAVLTree()
+    {
+        if constexpr (Balancing::deferred) stopMaintenance();
+
+        // _root hangs off the -inf sentinel; nodes removed earlier are still owned by _reclaimer
+        deleteTree(_head);
+    }
+
+    void print() const
+    {
+        printRecursive(_root->left.load(std::memory_order_relaxed));
+    }
+
+    static std::size_t nodeSize()
+    {
+        return sizeof(ConcurrentNode<T>);
+    }
+
+    /**
+    * @return the number of distinct cache lines holding the search fields (data through right) of the nodes
+    * a search for data visits. A diagnostic for comparing layouts; only call it while no thread writes. */
+    std::size_t cacheLinesTouched(Key data) const
+    {
+        std::size_t lines = 0;
+        for (auto node = _root; node != NULL; )
+        {
+            auto first = reinterpret_cast<std::uintptr_t>(&node->data) / 64;
+            auto last = (reinterpret_cast<std::uintptr_t>(&node->right + 1) - 1) / 64;
+            lines += last - first + 1;
+
+            int res = compareTo(data, node);
+            if (res == 0) break;
+            node = (res > 0 ? node->right : node->left).load(std::memory_order_relaxed);
+        }
+        return lines;
+    }
+
+    /**
+    * @return the number of nodes a search for data visits. A diagnostic for how balanced the tree is; only
+    * call it while no thread writes. */
+    std::size_t depth(Key data) const
+    {
+        std::size_t nodes = 0;
+        for (auto node = _root->left.load(std::memory_order_relaxed); node != NULL; )
+        {
+            ++nodes;
+            int res = compareTo(data, node);
+            if (res == 0) break;
+            node = (res > 0 ? node->right : node->left).load(std::memory_order_relaxed);
+        }
+        return nodes;
+    }
+
+    /**
+    * @return whether the tree and the list agree: an in-order walk of the tree meets every list member in
+    * list order, keys strictly ascending, each node's parent (and under LockedOrdering its pred) pointing
+    * back the way the walk came; and, unless the tree is unbalanced, every node's heights are exact and
+    * differ by at most one. A diagnostic for tests; only call it while no thread writes, and under
+    * DeferredBalancing once maintain() has caught up. */
+    bool checkStructure() const
+    {
+        auto height = [](const ConcurrentNode<T> *node) {
+            if (node == NULL) return 0;
+            return 1 + std::max<int>(node->left_tree_height.load(std::memory_order_relaxed),
+                                     node->right_tree_height.load(std::memory_order_relaxed));
+        };
+
+        std::vector<ConcurrentNode<T>*> path;
+        auto previous = _head;
+        auto node = _root->left.load(std::memory_order_relaxed);
+        if (node != NULL && node->parent.load(std::memory_order_relaxed) != _root) return false;
+
+        while (node != NULL || !path.empty())
+        {
+            for (; node != NULL; node = node->left.load(std::memory_order_relaxed))
+                path.push_back(node);
+            node = path.back();
+            path.pop_back();
+
+            // a marked succ, a node removed under LockFreeOrdering, fails this too
+            if (previous->succ.load(std::memory_order_relaxed) != node || compareTo(node->data, previous) <= 0)
+                return false;
+            if constexpr (!Ordering::lock_free)
+                if (node->pred.load(std::memory_order_relaxed) != previous || !node->valid.load(std::memory_order_relaxed))
+                    return false;
+
+            auto left = node->left.load(std::memory_order_relaxed);
+            auto right = node->right.load(std::memory_order_relaxed);
+            if ((left != NULL && left->parent.load(std::memory_order_relaxed) != node) ||
+                (right != NULL && right->parent.load(std::memory_order_relaxed) != node))
+                return false;
+
+            if constexpr (Balancing::rebalances || Balancing::deferred)
+            {
+                // checked at every node, the stored heights are exact all the way up from the leaves
+                int left_height = node->left_tree_height.load(std::memory_order_relaxed);
+                int right_height = node->right_tree_height.load(std::memory_order_relaxed);
+                if (left_height != height(left) || right_height != height(right) ||
+                    left_height - right_height > 1 || right_height - left_height > 1)
+                    return false;
+            }
+
+            previous = node;
+            node = right;
+        }
+
+        if (previous->succ.load(std::memory_order_relaxed) != _root) return false;
+        if constexpr (!Ordering::lock_free)
+            if (_root->pred.load(std::memory_order_relaxed) != previous) return false;
+        return true;
+    }
+
+    /**
+    * @return how many times the node allocator has called the global allocator (once per node for
+    * HeapAllocation, once per slab for PoolAllocation). */
+    std::uint64_t systemAllocations() const
+    {
+        return _allocator.systemAllocations();
+    }
+
+    /**
+    * @return the contention counters summed over all threads; all zero unless Stats is ContentionStats. */
+    ContentionSnapshot stats() const
+    {
+        return _stats.snapshot();
+    }
+
+    bool contains(Key data) const
+    {
+        Guard guard(_reclaimer);
+        return findNode(data, guard) != NULL;
+    }
+
+    /**
+    * Calls visitor with the stored element equal to data, if there is one, while the node holding it is
+    * still protected from reclamation. The element is const; a visitor may only change mutable members,
+    * under whatever synchronization those members carry (see ConcurrentAVLMap).
+    * @return true iff an element was found. */
+    template<typename Visitor>
+    bool visit(Key data, Visitor visitor) const
+    {
+        Guard guard(_reclaimer);
+        auto node = findNode(data, guard);
+        if (node) visitor(node->data);
+        return node != NULL;
+    }
+
+    /**
+    * results[i] = contains(keys[i]) for i < n, with the searches interleaved: lookup_lanes of them advance
+    * one level at a time, each prefetching the child it goes to next and only reading it on its next
+    * turn, so on a tree much larger than the cache the misses of several descents overlap instead of
+    * being paid one after the other. A lane that finishes takes the next key. Each result is what a
+    * contains at some point during the call would have returned.
+    * A validating reclaimer would need a hazard slot per lane, so HazardPointerReclamation just loops. */
+    void containsMany(const T *keys, std::size_t n, bool *results) const
+    {
+        if constexpr (Reclaimer::needs_validation)
+        {
+            for (std::size_t i = 0; i < n; ++i)
+                results[i] = contains(keys[i]);
+        }
+        else
+        {
+            struct Lane
+            {
+                std::size_t index;
+                ConcurrentNode<T> *node; // prefetched, read on the lane's next turn; NULL past a leaf
+                ConcurrentNode<T> *parent;
+                ConcurrentNode<T> *last_less;
+            };
+
+            Guard guard(_reclaimer);
+            Lane lanes[lookup_lanes];
+            std::size_t active = 0, next = 0;
+
+            auto start = [&](Lane &lane) {
+                lane.index = next++;
+                lane.node = _root->left.load(std::memory_order_acquire);
+                lane.parent = _root;
+                lane.last_less = _head;
+                __builtin_prefetch(lane.node);
+            };
+
+            for (; active < lookup_lanes && next < n; ++active)
+                start(lanes[active]);
+
+            while (active)
+            {
+                for (std::size_t i = 0; i < active; )
+                {
+                    auto &lane = lanes[i];
+                    Key data = keys[lane.index];
+                    auto node = lane.node;
+
+                    if (node)
+                    {
+                        bool below = lessKeys(node->data, data);
+                        if (below || lessKeys(data, node->data))
+                        {
+                            lane.last_less = select(below, node, lane.last_less);
+                            lane.parent = node;
+                            auto right = node->right.load(std::memory_order_acquire);
+                            auto left = node->left.load(std::memory_order_acquire);
+                            lane.node = select(below, right, left);
+                            __builtin_prefetch(lane.node);
+                            ++i;
+                            continue;
+                        }
+                    }
+
+                    // the descent ended at node holding data, or at parent when it ran off a leaf
+                    _stats.count(CONTAINS_CALLS);
+                    results[lane.index] = finishContains(data, node ? node : lane.parent, lane.last_less, guard);
+
+                    if (next < n)
+                    {
+                        start(lane);
+                        ++i;
+                    }
+                    else lane = lanes[--active];
+                }
+            }
+        }
+    }
+
+    struct End {};
+
+    /**
+    * Bidirectional cursor over the pred/succ list. It starts from a search and then follows succ (++)
+    * or pred (--) links, skipping nodes that are no longer members, so each step costs O(1). Two steps
+    * go back to the root: --, under LockFreeOrdering, which does not maintain pred; and any step that
+    * HazardPointerReclamation cannot validate off a node removed meanwhile. Such a step resumes at the
+    * first member after (or before) that node's key.
+    *
+    * Iteration is weakly consistent: keys come in strictly increasing order going forward (decreasing
+    * going back), each key present for the whole walk is reported, and a key inserted or removed during
+    * the walk may or may not be. An iterator holds a reclamation guard for as long as it lives, which
+    * keeps EpochReclamation from freeing anything retired meanwhile. Use it on the thread that created it
+    * and let it go out of scope like any other guard, in reverse order of creation. */
+    class Iterator
+    {
+    public:
+        Iterator(const Iterator &) = delete;
+        Iterator& operator=(const Iterator &) = delete;
+
+        /**
+        * @return false once the iterator has moved past either end. */
+        bool valid() const
+        {
+            return _node != _tree->_head && _node != _tree->_root;
+        }
+
+        const T& operator*() const { return _node->data; }
+        const T* operator->() const { return &_node->data; }
+
+        Iterator& operator++()
+        {
+            _node = _tree->nextMember(_node, _guard, _slot);
+            return *this;
+        }
+
+        Iterator& operator--()
+        {
+            _node = _tree->prevMember(_node, _guard, _slot);
+            return *this;
+        }
+
+        bool operator!=(End) const { return valid(); }
+
+    private:
+        friend class ConcurrentAVLTree;
+
+        template<typename Position>
+        Iterator(const ConcurrentAVLTree *tree, Position position) :
+            _tree(tree),
+            _guard(tree->_reclaimer),
+            _slot(CURSOR_A),
+            _node(position(_guard, _slot))
+        {
+        }
+
+        const ConcurrentAVLTree *_tree;
+        Guard _guard;
+        std::size_t _slot; // the cursor slot protecting _node
+        ConcurrentNode<T> *_node;
+    };
+
+    /**
+    * Iterators are neither copyable nor movable; take them as `auto it = tree.begin();` or in a
+    * range-based for. */
+    Iterator begin() const
+    {
+        return Iterator(this, [this](Guard &guard, std::size_t &slot) { return nextMember(_head, guard, slot); });
+    }
+
+    End end() const
+    {
+        return End();
+    }
+
+    /**
+    * @return an iterator at the first key not below data. */
+    Iterator from(Key data) const
+    {
+        return Iterator(this, [&](Guard &guard, std::size_t &slot) { return seekForward(data, true, guard, slot); });
+    }
+
+    /**
+    * @return an iterator at the greatest key, to walk backward with --. */
+    Iterator last() const
+    {
+        return Iterator(this, [this](Guard &guard, std::size_t &slot) { return prevMember(_root, guard, slot); });
+    }
+
+    /**
+    * Nearest keys: floor is the greatest key not above data, ceiling the least key not below it, and
+    * lower and higher the same without data itself. Each returns false if there is no such key, or else
+    * stores it in result. They cost a contains plus, under LockFreeOrdering, the succ steps from the
+    * last node below data on the search path; a concurrently removed neighbour adds a step or a search. */
+    bool floor(Key data, T &result) const
+    {
+        Guard guard(_reclaimer);
+        std::size_t slot = CURSOR_A;
+        return copyKey(seekBackward(data, true, guard, slot), result);
+    }
+
+    bool ceiling(Key data, T &result) const
+    {
+        Guard guard(_reclaimer);
+        std::size_t slot = CURSOR_A;
+        return copyKey(seekForward(data, true, guard, slot), result);
+    }
+
+    bool lower(Key data, T &result) const
+    {
+        Guard guard(_reclaimer);
+        std::size_t slot = CURSOR_A;
+        return copyKey(seekBackward(data, false, guard, slot), result);
+    }
+
+    bool higher(Key data, T &result) const
+    {
+        Guard guard(_reclaimer);
+        std::size_t slot = CURSOR_A;
+        return copyKey(seekForward(data, false, guard, slot), result);
+    }
+
+    /**
+    * Priority-queue use. The least key is the first member after the -inf sentinel and the greatest the
+    * last one before +inf, so these read the ends of the pred/succ list and pop removes the node found
+    * there without searching for it again. Each returns false if the tree is empty.
+    *
+    * Poppers all contending for one end would serialize on it. With spray > 1, a pop instead takes a
+    * key picked at random among the spray keys nearest the end, as counted by its own walk; a spray about
+    * the number of popping threads spreads them out while keeping every popped key close to the end. */
+    bool peekMin(T &result) const
+    {
+        Guard guard(_reclaimer);
+        std::size_t slot = CURSOR_A;
+        return copyKey(nextMember(_head, guard, slot), result);
+    }
+
+    bool peekMax(T &result) const
+    {
+        Guard guard(_reclaimer);
+        std::size_t slot = CURSOR_A;
+        return copyKey(prevMember(_root, guard, slot), result);
+    }
+
+    bool popMin(T &result, std::size_t spray = 1)
+    {
+        return popEnd(true, result, spray);
+    }
+
+    bool popMax(T &result, std::size_t spray = 1)
+    {
+        return popEnd(false, result, spray);
+    }
+
+    /**
+    * Calls callback(key) for the keys in [lo, hi] in increasing order, with the consistency of an
+    * iterator, in a single guard and a single search. */
+    template<typename Callback>
+    void range(Key lo, Key hi, Callback callback) const
+    {
+        Guard guard(_reclaimer);
+        std::size_t slot = CURSOR_A;
+
+        for (auto node = seekForward(lo, true, guard, slot); node != _root && compareTo(hi, node) >= 0; node = nextMember(node, guard, slot))
+            callback(node->data);
+    }
+
+    bool insert(Key data)
+    {
+        keepBudget();
+        if constexpr (Ordering::lock_free) return insertLockFree(data);
+
+        Guard guard(_reclaimer);
+
+        for (int attempt = 0; ; ++attempt)
+        {
+            if (attempt) _stats.count(INSERT_RETRIES);
+
+            auto node = search(data, guard);
+            int res = compareTo(data, node);
+            auto pred = node;
+            if (res <= 0 && !follow(guard, PRED, pred, [=] { return node->pred.load(std::memory_order_acquire); })) continue;
+
+            try
+            {
+                lockWith<Backoff>(pred->succ_lock);
+
+                if (pred->valid.load(std::memory_order_relaxed))
+                {
+                    int pred_res = (pred == node ? res : compareTo(data, pred));
+
+                    if (pred_res > 0)
+                    {
+                        auto succ = pred->succ.load(std::memory_order_relaxed);
+                        int res2 = (succ == node ? res : compareTo(data, succ));
+                        if (res2 <= 0)
+                        {
+                            if (res2 == 0)
+                            {
+                                bool revived = false;
+                                if constexpr (Removal::leaves_tombstones) revived = setDeleted(succ, false);
+                                pred->succ_lock.unlock();
+                                return revived;
+                            }
+
+                            auto parent = chooseParent(pred, succ, node);
+                            auto newNode = createNode(data, pred, succ, parent);
+                            if constexpr (Removal::leaves_tombstones) _removal.addNodes(1);
+
+                            succ->pred.store(newNode, std::memory_order_release);
+                            pred->succ.store(newNode, std::memory_order_release);
+                            pred->succ_lock.unlock();
+                            insertToTree(parent, newNode, parent == pred, guard);
+                            return true;
+                        }
+                    }
+                }
+
+                pred->succ_lock.unlock();
+            }
+            catch (const std::exception &e)
+            {
+                std::cout << "Error insert: " << e.what() << std::endl;
+                pred->succ_lock.unlock();
+                return false;
+            }
+        }
+
+        // should never reach
+        return true;
+    }
+
+
+    bool remove(Key data)
+    {
+        keepBudget();
+        purgeIfDue();
+        if constexpr (Ordering::lock_free) return removeLockFree(data);
+
+        Guard guard(_reclaimer);
+
+        for (int attempt = 0; ; ++attempt)
+        {
+            if (attempt) _stats.count(REMOVE_RETRIES);
+
+            auto node = search(data, guard);
+            int res = compareTo(data, node);
+            auto pred = node;
+            if (res <= 0 && !follow(guard, PRED, pred, [=] { return node->pred.load(std::memory_order_acquire); })) continue;
+
+            auto outcome = removeAfter(data, pred, node, res, guard);
+            if (outcome != RETRY) return outcome == REMOVED;
+        }
+    }
+
+    /**
+    * Inserts the keys in [first, last), which should be sorted ascending; keys already present are
+    * skipped. Each key's window is found by walking succ links from where the previous key went (up
+    * to finger_steps of them) rather than by a search from the root. Consecutive keys that fall into the
+    * same gap of the list, up to max_run of them, are linked in with one splice and attached to the
+    * tree as a balanced subtree, which then takes a single rebalance pass. Unsorted input is still
+    * inserted correctly, each out-of-order key through a search.
+    * The whole batch runs in one guard, so EpochReclamation frees nothing retired meanwhile.
+    * @return the number of keys inserted. */
+    template<typename ForwardIt>
+    std::size_t insertBatch(ForwardIt first, ForwardIt last)
+    {
+        keepBudget();
+        Guard guard(_reclaimer);
+        std::size_t slot = CURSOR_A;
+        ConcurrentNode<T> *finger = NULL;
+        return insertSorted(first, last, guard, slot, finger);
+    }
+
+    /**
+    * Handle for the hinted insert and find: the node the last operation through it ended at, which the
+    * next one starts from. It holds a reclamation guard for as long as it lives, like an Iterator, and
+    * the same rules apply: use it on the thread and with the tree that created it. */
+    class Hint
+    {
+    public:
+        Hint(const Hint &) = delete;
+        Hint& operator=(const Hint &) = delete;
+
+    private:
+        friend class ConcurrentAVLTree;
+
+        explicit Hint(const ConcurrentAVLTree *tree) :
+            _guard(tree->_reclaimer),
+            _slot(CURSOR_A),
+            _node(NULL)
+        {
+        }
+
+        Guard _guard;
+        std::size_t _slot; // the cursor slot protecting _node
+        ConcurrentNode<T> *_node;
+    };
+
+    /**
+    * @return an empty hint; its first operation searches from the root. Take it as `auto hint = tree.hint();`. */
+    Hint hint() const
+    {
+        return Hint(this);
+    }
+
+    /**
+    * insert and contains for keys next to the one the hint last touched. When the hint's node is still
+    * a member and data lies between it and a neighbour (its pred, which only LockedOrdering keeps, or up
+    * to finger_steps of succ links ahead), no search from the root is done; otherwise they fall back to
+    * one. Either way the hint moves to data's node, or next to its place when find misses.
+    * insert(hint, data) behaves exactly as insertBatch of that one key. */
+    bool insert(Hint &hint, Key data)
+    {
+        keepBudget();
+        return insertSorted(&data, &data + 1, hint._guard, hint._slot, hint._node) == 1;
+    }
+
+    bool find(Hint &hint, Key data) const
+    {
+        auto &guard = hint._guard;
+        auto &slot = hint._slot;
+        auto node = hint._node;
+        if (node && compareTo(data, node) == 0 && isMember(node)) return true;
+
+        // keys inserted since fingerWindow looked can put a few more steps between pred and data
+        for (auto pred = fingerWindow(data, node, guard, slot); pred; )
+        {
+            auto curr = pred;
+            auto curr_slot = cursorAfter(slot, 1);
+            if (!stepForward(guard, curr_slot, curr)) break;
+
+            int res = compareTo(data, curr);
+            if (res > 0)
+            {
+                pred = curr;
+                slot = curr_slot;
+                continue;
+            }
+
+            bool found = res == 0 && isMember(curr);
+            if (res == 0 && !found && purgedMatch(data, curr)) break;
+            hint._node = found ? curr : pred;
+            if (found) slot = curr_slot;
+            return found;
+        }
+
+        // the same search as contains, plus a step onto the first member past data when it is absent
+        slot = CURSOR_A;
+        hint._node = seekForward(data, true, guard, slot);
+        return compareTo(data, hint._node) == 0;
+    }
+
+    /**
+    * Removes the keys in [first, last), which should be sorted ascending, finding each from where the
+    * previous one was as insertBatch does. Removals are not coalesced: each one still unlinks and
+    * rebalances on its own.
+    * @return the number of keys removed. */
+    template<typename ForwardIt>
+    std::size_t removeBatch(ForwardIt first, ForwardIt last)
+    {
+        keepBudget();
+        purgeIfDue();
+        Guard guard(_reclaimer);
+        std::size_t slot = CURSOR_A;
+        std::size_t removed = 0;
+        ConcurrentNode<T> *finger = NULL;
+
+        while (first != last)
+        {
+            Key data = *first;
+            auto pred = batchWindow(data, finger, guard, slot);
+            finger = NULL;
+
+            if constexpr (Ordering::lock_free)
+            {
+                auto curr = pred;
+                if (!stepForward(guard, cursorAfter(slot, 1), curr)) continue;
+
+                int res = compareTo(data, curr);
+                if (res > 0)
+                {
+                    finger = pred;
+                    continue;
+                }
+                // a node already marked counts as absent, as in remove
+                if (res == 0 && removeNode(curr, guard)) ++removed;
+            }
+            else
+            {
+                auto outcome = removeAfter(data, pred, pred, compareTo(data, pred), guard);
+                if (outcome == RETRY)
+                {
+                    if (pred->valid.load(std::memory_order_acquire)) finger = pred;
+                    continue;
+                }
+                if (outcome == REMOVED) ++removed;
+            }
+
+            ++first;
+            finger = pred;
+        }
+
+        return removed;
+    }
+
+    /**
+    * DeferredBalancing: how many fixes a thread may leave pending. An update that finds its thread's log
+    * that long applies the log before it starts, so 1 rebalances right after every update, only not in it. */
+    void setImbalanceBudget(std::size_t fixes)
+    {
+        static_assert(Balancing::deferred, "only DeferredBalancing defers rebalancing");
+        _imbalance_budget.store(std::max<std::size_t>(fixes, 1), std::memory_order_relaxed);
+    }
+
+    /**
+    * DeferredBalancing: applies the fixes all threads have left pending so far, and those the rotations it
+    * makes leave in turn. It runs alongside any other operation; once it returns with no update in flight,
+    * the heights are exact and the tree is as balanced as AVLBalancing keeps it.
+    * @return the number of fixes applied. */
+    std::size_t maintain()
+    {
+        static_assert(Balancing::deferred, "only DeferredBalancing defers rebalancing");
+        std::size_t applied = 0;
+        do
+        {
+            for (std::size_t i = 0; i < ThreadRegistry::highWater(); ++i)
+                applied += applyFixes(i);
+        }
+        while (_pending.pending());
+        return applied;
+    }
+
+    /**
+    * DeferredBalancing: starts a thread that calls maintain() until stopMaintenance or the destructor, again
+    * right away while it finds fixes and otherwise after period. */
+    void startMaintenance(std::chrono::microseconds period = std::chrono::microseconds(1000))
+    {
+        static_assert(Balancing::deferred, "only DeferredBalancing defers rebalancing");
+        if (_maintainer.joinable()) return;
+
+        _maintaining.store(true, std::memory_order_relaxed);
+        _maintainer = std::thread([this, period]() {
+            while (_maintaining.load(std::memory_order_relaxed))
+                if (!maintain()) std::this_thread::sleep_for(period);
+        });
+    }
+
+    /**
+    * DeferredBalancing: stops the thread startMaintenance started, if any. Fixes still pending stay so. */
+    void stopMaintenance()
+    {
+        static_assert(Balancing::deferred, "only DeferredBalancing defers rebalancing");
+        if (!_maintainer.joinable()) return;
+
+        _maintaining.store(false, std::memory_order_relaxed);
+        _maintainer.join();
+    }
+
+    /**
+    * TombstoneRemoval: the share of the tree's nodes tombstones may make up before a remove purges them;
+    * each thread checks every few hundred removes. */
+    void setPurgeRatio(double ratio)
+    {
+        static_assert(Removal::leaves_tombstones, "only TombstoneRemoval leaves tombstones");
+        _removal.setPurgeRatio(ratio);
+    }
+
+    /**
+    * TombstoneRemoval: @return about how many tombstones the tree holds. */
+    std::size_t tombstones() const
+    {
+        static_assert(Removal::leaves_tombstones, "only TombstoneRemoval leaves tombstones");
+        return std::size_t(std::max<std::int64_t>(_removal.tombstones(), 0));
+    }
+
+    /**
+    * TombstoneRemoval: takes the tombstones out of the list and the tree in one walk along the list, each
+    * the way remove takes out a node under UnlinkRemoval; one revived before the walk reaches it stays.
+    * It runs alongside any other operation, letting go of its guard every snapshot_chunk nodes. Only one
+    * purge runs at a time: while another is under way it returns at once.
+    * @return the number of tombstones removed. */
+    std::size_t purge()
+    {
+        static_assert(Removal::leaves_tombstones, "only TombstoneRemoval leaves tombstones");
+        if (!_removal.tryStartPurge()) return 0;
+
+        std::size_t purged = 0;
+        T resume_at = T();
+        bool from_head = true;
+
+        while (true)
+        {
+            Guard guard(_reclaimer);
+            std::size_t slot = CURSOR_A;
+            auto pred = from_head ? _head : seekBackward(resume_at, false, guard, slot);
+            auto curr = pred;
+
+            for (std::size_t i = 0; i < snapshot_chunk; ++i)
+            {
+                auto next_slot = cursorAfter(slot, 1);
+                curr = pred;
+                if (!stepForward(guard, next_slot, curr) || curr == _root) break;
+
+                // the slot curr is in gets reused for pred's next successor once curr is gone
+                if (curr->deleted.load(std::memory_order_acquire) && unlinkTombstone(pred, curr, guard)) ++purged;
+                else
+                {
+                    pred = curr;
+                    slot = next_slot;
+                }
+            }
+
+            if (curr == _root) break;
+            from_head = pred == _head;
+            if (!from_head) resume_at = pred->data;
+        }
+
+        _removal.finishPurge();
+        return purged;
+    }
+
+private:
+    /**
+    * DeferredBalancing: a node whose heights an update left stale, by key, to find it again, and by address,
+    * only ever compared, to tell whether the node found is still that one. */
+    struct Fix
+    {
+        T key;
+        const void *node;
+    };
+
+    // declared first so it outlives _reclaimer, whose destructor still frees retired nodes into it
+    Allocator _allocator;
+    ConcurrentNode<T> *_head;
+    ConcurrentNode<T> *_root;
+    mutable Reclaimer _reclaimer;
+    mutable Stats _stats;
+    Compare _less;
+    typename std::conditional<Balancing::deferred, PendingFixes<Fix>, NoPendingFixes>::type _pending;
+    std::atomic<std::size_t> _imbalance_budget{default_imbalance_budget};
+    std::atomic<bool> _maintaining{false};
+    std::thread _maintainer;
+    Removal _removal;
+
+    ConcurrentNode<T>* createNode(Key data, ConcurrentNode<T> *pred, ConcurrentNode<T> *succ, ConcurrentNode<T> *parent)
+    {
+        return new (_allocator.allocate()) ConcurrentNode<T>(data, pred, succ, parent);
+    }
+
+    void destroyNode(ConcurrentNode<T> *node)
+    {
+        node->~ConcurrentNode<T>();
+        _allocator.deallocate(node);
+    }
+
+    static void reclaimNode(void *tree, void *node)
+    {
+        static_cast<ConcurrentAVLTree*>(tree)->destroyNode(static_cast<ConcurrentNode<T>*>(node));
+    }
+
+    // every wait on another thread goes through here so it can be counted; see Backoff.h
+    void backOff(Backoff &backoff) const
+    {
+        _stats.count(YIELDS);
+        backoff.wait();
+    }
+
+    static ConcurrentNode<T>* marked(ConcurrentNode<T> *node)
+    {
+        return reinterpret_cast<ConcurrentNode<T>*>(reinterpret_cast<std::uintptr_t>(node) | 1);
+    }
+
+    static ConcurrentNode<T>* unmarked(ConcurrentNode<T> *node)
+    {
+        return reinterpret_cast<ConcurrentNode<T>*>(reinterpret_cast<std::uintptr_t>(node) & ~std::uintptr_t(1));
+    }
+
+    static bool isMarked(ConcurrentNode<T> *node)
+    {
+        return reinterpret_cast<std::uintptr_t>(node) & 1;
+    }
+
+    bool lessKeys(Key a, Key b) const
+    {
+        return _less(a, b);
+    }
+
+    /**
+    * @return <0, 0 or >0 as data orders before, with or after node's key. _head is below and _root above
+    * every key; neither is ever equal to one. */
+    int compareTo(Key data, const ConcurrentNode<T> *node) const
+    {
+        if (node == _root) return -1;
+        if (node == _head) return 1;
+
+        if constexpr (integral_keys) return (data > node->data) - (data < node->data);
+        else return _less(data, node->data) ? -1 : (_less(node->data, data) ? 1 : 0);
+    }
+
+    /**
+    * cond ? a : b without a branch. Next to the child selection in search a plain ternary is merged
+    * into one branch on the descent direction, which mispredicts about every other level. */
+    static ConcurrentNode<T>* select(bool cond, ConcurrentNode<T> *a, ConcurrentNode<T> *b)
+    {
+        auto mask = std::uintptr_t(0) - std::uintptr_t(cond);
+        return reinterpret_cast<ConcurrentNode<T>*>((reinterpret_cast<std::uintptr_t>(a) & mask) | (reinterpret_cast<std::uintptr_t>(b) & ~mask));
+    }
+
+    /**
+    * Moves node along the link returned by load, publishing the target in slot. Under a validating
+    * reclaimer the link only counts if node is still valid once the target is published; otherwise
+    * node is left untouched, false is returned and the caller restarts from the root. */
+    template<typename Load>
+    bool follow(Guard &guard, std::size_t slot, ConcurrentNode<T> *&node, Load load) const
+    {
+        auto next = guard.protect(slot, load);
+        if (Reclaimer::needs_validation && !node->valid.load(std::memory_order_acquire)) return false;
+
+        node = next;
+        return true;
+    }
+
+    /**
+    * When last_less is given it receives the last node below data on the path, or _head if there is none.
+    * Under a validating reclaimer only nodes whose succ was unmarked when visited count.
+    * Every key is below _root, so the descent starts at its left child and only ever compares real keys;
+    * _root itself comes back only when the tree is empty.
+    * With past_equal, a node holding data does not end the search, which goes on into its left subtree;
+    * last_less is then data's in-order predecessor among the nodes in the tree. */
+    template<bool past_equal = false>
+    ConcurrentNode<T>* search(Key data, Guard &guard, ConcurrentNode<T> **last_less = NULL) const
+    {
+        while (true)
+        {
+            ConcurrentNode<T> *node = _root;
+            ConcurrentNode<T> *child;
+            std::size_t slot = SEARCH_A;
+            if (last_less) *last_less = _head;
+
+            if (!follow(guard, slot, node, [=] { return _root->left.load(std::memory_order_acquire); })) continue;
+            if (node == NULL) return _root;
+
+            while (true)
+            {
+                const auto &curr_data = node->data;
+                bool below = lessKeys(curr_data, data);
+                if (!past_equal && !below && !lessKeys(data, curr_data)) return node;
+
+                if (last_less && Reclaimer::needs_validation)
+                {
+                    // a marked pred fails validation in locate, so skip it here and keep the walk from restarting
+                    if (below && !isMarked(node->succ.load(std::memory_order_acquire)))
+                        *last_less = guard.protect(LAST_LESS, [=] { return node; });
+                }
+                else if (last_less)
+                {
+                    *last_less = select(below, node, *last_less);
+                }
+
+                slot = (slot == SEARCH_A) ? SEARCH_B : SEARCH_A;
+                child = node;
+                // both children share a line; loading both and selecting keeps the descent free of a data-dependent branch
+                if (!follow(guard, slot, child, [=] {
+                    auto right = node->right.load(std::memory_order_acquire);
+                    auto left = node->left.load(std::memory_order_acquire);
+                    return below ? right : left;
+                })) break;
+
+                if (child == NULL) return node;
+
+                node = child;
+            }
+        }
+    }
+
+    /**
+    * @return the valid node holding data, or NULL. Stays protected by guard. */
+    ConcurrentNode<T>* findNode(Key data, Guard &guard) const
+    {
+        if constexpr (Ordering::lock_free) return findNodeLockFree(data, guard);
+
+        _stats.count(CONTAINS_CALLS);
+
+        // every way round the loop is a retry on a node another thread is taking out
+        Backoff backoff;
+        for (;; backOff(backoff))
+        {
+            auto node = firstNotBelow(data, guard);
+            if (!node) continue;
+            if (compareTo(data, node) != 0) return NULL;
+            if (isMember(node)) return node;
+            if (!purgedMatch(data, node)) return NULL;
+        }
+    }
+
+    /**
+    * Locked ordering: the first list node not below data, found by walking pred and succ links from
+    * where the search ends, or NULL when the walk could not be trusted and the search has to be redone. */
+    ConcurrentNode<T>* firstNotBelow(Key data, Guard &guard) const
+    {
+        return walkTo(data, search(data, guard), guard);
+    }
+
+    /**
+    * The end of contains once the search for data has ended at node, with last_less the last node below
+    * data on its path: the walk of findNodeLockFree, or that of findNode, falling back on findNode itself
+    * when the walk cannot be trusted. */
+    bool finishContains(Key data, ConcurrentNode<T> *node, ConcurrentNode<T> *last_less, Guard &guard) const
+    {
+        if constexpr (Ordering::lock_free)
+        {
+            auto curr = node;
+            if (compareTo(data, curr) != 0)
+            {
+                std::uint64_t steps = 0;
+                walkWindow(data, guard, last_less, curr, Stats::enabled ? &steps : NULL);
+                _stats.count(CONTAINS_WALK_STEPS, steps);
+            }
+            return compareTo(data, curr) == 0 && !isMarked(curr->succ.load(std::memory_order_acquire));
+        }
+        else
+        {
+            node = walkTo(data, node, guard);
+            if (!node) return findNode(data, guard) != NULL;
+            if (compareTo(data, node) != 0) return false;
+            return isMember(node) || (purgedMatch(data, node) && findNode(data, guard));
+        }
+    }
+
+    /**
+    * The pred/succ walk of firstNotBelow from the node a search ended at, NULL when a validating reclaimer
+    * cuts it short or the search ended at a node already out of the list: a node stays in the tree for a
+    * while after that, and its links can predate keys inserted since, so a walk from it may skip data. */
+    ConcurrentNode<T>* walkTo(Key data, ConcurrentNode<T> *node, Guard &guard) const
+    {
+        if (!node->valid.load(std::memory_order_acquire)) return NULL;
+
+        std::size_t slot = WALK_A;
+        bool linked = true;
+
+        while (linked && compareTo(data, node) < 0)
+        {
+            linked = follow(guard, slot, node, [=] { return node->pred.load(std::memory_order_acquire); });
+            slot = (slot == WALK_A) ? WALK_B : WALK_A;
+            _stats.count(CONTAINS_WALK_STEPS);
+        }
+        while (linked && compareTo(data, node) > 0)
+        {
+            linked = follow(guard, slot, node, [=] { return node->succ.load(std::memory_order_acquire); });
+            slot = (slot == WALK_A) ? WALK_B : WALK_A;
+            _stats.count(CONTAINS_WALK_STEPS);
+        }
+
+        return linked ? node : NULL;
+    }
+
+    /**
+    * Iteration. A cursor's current node sits in one of the three CURSOR slots. A seek may start from
+    * the key of the node it stands on, so it keeps that node's slot and alternates between the other two
+    * while it still compares against the key; plain steps rotate through all three.
+    * Under LockFreeOrdering a node is a member while its succ is unmarked, otherwise while it is valid
+    * and, under TombstoneRemoval, not deleted. deleted is read first: a node still valid after that read
+    * was in the list at the time, so the answer held then. */
+    bool isMember(ConcurrentNode<T> *node) const
+    {
+        if constexpr (Ordering::lock_free) return !isMarked(node->succ.load(std::memory_order_acquire));
+        else if constexpr (Removal::leaves_tombstones)
+            return !node->deleted.load(std::memory_order_acquire) && node->valid.load(std::memory_order_acquire);
+        else return node->valid.load(std::memory_order_acquire);
+    }
+
+    /**
+    * TombstoneRemoval: node holds data but a purge has unlinked it. Until the purge has it out of the tree
+    * too a search can still end there after data was inserted again, so whoever reached it searches again
+    * rather than take it for the answer. */
+    bool purgedMatch(Key data, ConcurrentNode<T> *node) const
+    {
+        if constexpr (Removal::leaves_tombstones)
+            return compareTo(data, node) == 0 && !node->valid.load(std::memory_order_acquire);
+        else return false;
+    }
+
+    // a seek's result: false for the sentinels, which mean there is no such key
+    bool copyKey(const ConcurrentNode<T> *node, T &result) const
+    {
+        if (node == _head || node == _root) return false;
+        result = node->data;
+        return true;
+    }
+
+    // per-thread xorshift, so spraying poppers neither share state nor start in step
+    static std::size_t sprayOffset(std::size_t spray)
+    {
+        thread_local std::uint32_t state = 2463534242u + 0x9E3779B9u * static_cast<std::uint32_t>(ThreadRegistry::index());
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state % spray;
+    }
+
+    /**
+    * @return the first member from the min (or max) end, or one up to spray - 1 members further in;
+    * the opposite sentinel if the tree is empty. */
+    ConcurrentNode<T>* sprayedEnd(bool min, std::size_t spray, Guard &guard, std::size_t &slot) const
+    {
+        auto end = min ? _head : _root;
+        auto other = min ? _root : _head;
+        auto step = [&](ConcurrentNode<T> *node) { return min ? nextMember(node, guard, slot) : prevMember(node, guard, slot); };
+
+        auto node = step(end);
+        for (auto skip = spray > 1 ? sprayOffset(spray) : 0; skip > 0 && node != other; --skip)
+        {
+            auto next = step(node);
+            if (next == other) return step(end); // fewer members than the offset
+            node = next;
+        }
+        return node;
+    }
+
+    bool popEnd(bool min, T &result, std::size_t spray)
+    {
+        keepBudget();
+        purgeIfDue();
+        Guard guard(_reclaimer);
+
+        for (int attempt = 0; ; ++attempt)
+        {
+            if (attempt) _stats.count(REMOVE_RETRIES);
+
+            std::size_t slot = CURSOR_A;
+            auto node = sprayedEnd(min, spray, guard, slot);
+            if (node == _head || node == _root) return false;
+
+            bool removed;
+            if constexpr (Ordering::lock_free) removed = removeNode(node, guard);
+            else
+            {
+                auto pred = node;
+                if (!follow(guard, PRED, pred, [=] { return node->pred.load(std::memory_order_acquire); })) continue;
+                removed = removeAfter(node->data, pred, node, 0, guard) == REMOVED;
+            }
+
+            // node is retired but still protected by guard
+            if (removed)
+            {
+                result = node->data;
+                return true;
+            }
+        }
+    }
+
+    static std::size_t cursorAfter(std::size_t slot, std::size_t n)
+    {
+        return CURSOR_A + (slot - CURSOR_A + n) % 3;
+    }
+
+    // publishes a node that is already protected elsewhere in the guard, so it stays protected in slot
+    static ConcurrentNode<T>* pin(Guard &guard, std::size_t slot, ConcurrentNode<T> *node)
+    {
+        return guard.protect(slot, [=] { return node; });
+    }
+
+    /**
+    * Moves node to its succ, publishing it in slot. Under a validating reclaimer it fails, leaving node
+    * untouched, if the link can no longer be trusted: node is invalid (locked ordering) or its succ
+    * changed or got marked (lock-free). */
+    bool stepForward(Guard &guard, std::size_t slot, ConcurrentNode<T> *&node) const
+    {
+        auto current = node;
+        if constexpr (Ordering::lock_free)
+        {
+            auto next = guard.protect(slot, [=] { return unmarked(current->succ.load(std::memory_order_acquire)); });
+            if (Reclaimer::needs_validation && current->succ.load(std::memory_order_acquire) != next) return false;
+
+            node = next;
+            return true;
+        }
+        else return follow(guard, slot, node, [=] { return current->succ.load(std::memory_order_acquire); });
+    }
+
+    /**
+    * @return the first member after node, or _root. node is protected in slot, which is updated. */
+    ConcurrentNode<T>* nextMember(ConcurrentNode<T> *node, Guard &guard, std::size_t &slot) const
+    {
+        if (node == _root) return _root;
+
+        while (true)
+        {
+            auto next_slot = cursorAfter(slot, 1);
+            if (!stepForward(guard, next_slot, node)) return seekForward(node->data, false, guard, slot);
+
+            slot = next_slot;
+            if (node == _root || isMember(node)) return node;
+        }
+    }
+
+    /**
+    * @return the last member before node, or _head. node is protected in slot, which is updated. */
+    ConcurrentNode<T>* prevMember(ConcurrentNode<T> *node, Guard &guard, std::size_t &slot) const
+    {
+        if (node == _head) return _head;
+
+        if constexpr (Ordering::lock_free)
+        {
+            return node == _root ? lastLockFree(guard, slot) : seekBackward(node->data, false, guard, slot);
+        }
+        else
+        {
+            while (true)
+            {
+                auto next_slot = cursorAfter(slot, 1);
+                auto current = node;
+                if (!follow(guard, next_slot, node, [=] { return current->pred.load(std::memory_order_acquire); }))
+                    return seekBackward(node->data, false, guard, slot);
+
+                slot = next_slot;
+                if (node == _head || isMember(node)) return node;
+            }
+        }
+    }
+
+    /**
+    * @return the first member not below data (inclusive) or above data, or _root. When data is the key
+    * of a node, that node must be protected in slot; the result is protected in slot on return. */
+    ConcurrentNode<T>* seekForward(Key data, bool inclusive, Guard &guard, std::size_t &slot) const
+    {
+        Backoff backoff;
+        auto a = cursorAfter(slot, 1), b = cursorAfter(slot, 2);
+
+        for (;; backOff(backoff))
+        {
+            ConcurrentNode<T> *node;
+            if constexpr (Ordering::lock_free)
+            {
+                ConcurrentNode<T> *pred;
+                if (!locate(data, guard, pred, node)) continue;
+            }
+            else if (!(node = firstNotBelow(data, guard))) continue;
+
+            if (inclusive && purgedMatch(data, node)) continue;
+
+            node = pin(guard, a, node);
+            auto at = a;
+            bool linked = true;
+
+            // list keys only grow from here, so at most one node can still equal data
+            if (!inclusive && node != _root && compareTo(data, node) == 0)
+            {
+                linked = stepForward(guard, b, node);
+                at = b;
+            }
+            while (linked && node != _root && !isMember(node))
+            {
+                at = (at == a) ? b : a;
+                linked = stepForward(guard, at, node);
+            }
+
+            if (linked)
+            {
+                slot = at;
+                return node;
+            }
+        }
+    }
+
+    /**
+    * @return the last member not above data (inclusive) or below data, or _head; slots as for seekForward. */
+    ConcurrentNode<T>* seekBackward(Key data, bool inclusive, Guard &guard, std::size_t &slot) const
+    {
+        Backoff backoff;
+        auto a = cursorAfter(slot, 1), b = cursorAfter(slot, 2);
+
+        for (;; backOff(backoff))
+        {
+            if constexpr (Ordering::lock_free)
+            {
+                ConcurrentNode<T> *pred, *curr;
+                if (!locate(data, guard, pred, curr, NULL, !inclusive)) continue;
+
+                // a hit on data's node skips the walk to pred, which is then only needed if that node is going
+                slot = a;
+                if (inclusive && compareTo(data, curr) == 0)
+                {
+                    if (isMember(curr)) return pin(guard, a, curr);
+                    if (!locate(data, guard, pred, curr, NULL, true)) continue;
+                }
+
+                pred = pin(guard, a, pred);
+                if (pred == _head || isMember(pred)) return pred;
+
+                // pred is being removed; whatever precedes it precedes data as well
+                return seekBackward(pred->data, false, guard, slot);
+            }
+            else
+            {
+                auto node = firstNotBelow(data, guard);
+                if (!node) continue;
+                if (inclusive && purgedMatch(data, node)) continue;
+
+                node = pin(guard, a, node);
+                slot = a;
+                if (inclusive && compareTo(data, node) == 0 && isMember(node)) return node;
+
+                auto at = a;
+                bool linked = true;
+
+                do
+                {
+                    auto current = node;
+                    at = (at == a) ? b : a;
+                    linked = follow(guard, at, node, [=] { return current->pred.load(std::memory_order_acquire); });
+                }
+                while (linked && node != _head && (compareTo(data, node) <= 0 || !isMember(node)));
+
+                if (linked)
+                {
+                    slot = at;
+                    return node;
+                }
+            }
+        }
+    }
+
+    /**
+    * Lock-free ordering keeps no pred for _root, so the last member is found from the rightmost node
+    * of the physical tree by walking succ links up to _root. */
+    ConcurrentNode<T>* lastLockFree(Guard &guard, std::size_t &slot) const
+    {
+        auto a = cursorAfter(slot, 1), b = cursorAfter(slot, 2);
+
+        while (true)
+        {
+            ConcurrentNode<T> *node = _root;
+            std::size_t search_slot = SEARCH_A;
+            bool linked = follow(guard, search_slot, node, [=] { return _root->left.load(std::memory_order_acquire); });
+
+            while (linked && node)
+            {
+                auto current = node;
+                search_slot = (search_slot == SEARCH_A) ? SEARCH_B : SEARCH_A;
+                linked = follow(guard, search_slot, node, [=] { return current->right.load(std::memory_order_acquire); });
+                if (linked && !node)
+                {
+                    node = current;
+                    break;
+                }
+            }
+            if (!linked) continue;
+
+            auto pred = pin(guard, a, node ? node : _head);
+            auto at = a;
+
+            while (linked)
+            {
+                auto curr = pred;
+                auto next_at = (at == a) ? b : a;
+                linked = stepForward(guard, next_at, curr);
+                if (!linked || curr == _root) break;
+
+                pred = curr;
+                at = next_at;
+            }
+            if (!linked) continue;
+
+            slot = at;
+            if (pred == _head || isMember(pred)) return pred;
+            return seekBackward(pred->data, false, guard, slot);
+        }
+    }
+
+
+    static const std::size_t lookup_lanes = 16;
+    static const std::size_t parallel_build_keys = 4096;
+    static const std::size_t snapshot_chunk = 4096;
+    static const int finger_steps = 16;
+    static const std::size_t max_run = 64;
+    static const std::size_t default_imbalance_budget = 64;
+
+    /**
+    * Batches and hints: the node after which data belongs, found without a search from finger, a member
+    * protected in slot (updated), at most finger_steps succ links ahead of finger or, under LockedOrdering,
+    * pred links behind it. NULL when data is out of reach.
+    * Callers check the node under the lock or CAS that uses it. */
+    ConcurrentNode<T>* fingerWindow(Key data, ConcurrentNode<T> *finger, Guard &guard, std::size_t &slot) const
+    {
+        if (!finger || !isMember(finger)) return NULL;
+
+        if (compareTo(data, finger) <= 0)
+        {
+            if constexpr (Ordering::lock_free) return NULL;
+            else
+            {
+                auto node = finger;
+                for (int step = 0; step < finger_steps; ++step)
+                {
+                    auto current = node;
+                    auto pred_slot = cursorAfter(slot, 1);
+                    if (!follow(guard, pred_slot, node, [=] { return current->pred.load(std::memory_order_acquire); })) break;
+
+                    slot = pred_slot;
+                    if (compareTo(data, node) > 0) return node;
+                }
+                return NULL;
+            }
+        }
+
+        auto node = finger;
+        for (int step = 0; step < finger_steps; ++step)
+        {
+            auto next = node;
+            auto next_slot = cursorAfter(slot, 1);
+            if (!stepForward(guard, next_slot, next)) break;
+            if (compareTo(data, next) <= 0) return node;
+
+            node = next;
+            slot = next_slot;
+        }
+        return NULL;
+    }
+
+    /**
+    * fingerWindow, falling back to a search; callers pass the node back as the finger when it turns out
+    * to lie further back. */
+    ConcurrentNode<T>* batchWindow(Key data, ConcurrentNode<T> *finger, Guard &guard, std::size_t &slot) const
+    {
+        if (auto pred = fingerWindow(data, finger, guard, slot)) return pred;
+
+        while (true)
+        {
+            ConcurrentNode<T> *pred;
+            if constexpr (Ordering::lock_free)
+            {
+                ConcurrentNode<T> *curr;
+                if (!locate(data, guard, pred, curr, NULL, true)) continue;
+            }
+            else
+            {
+                auto node = search(data, guard);
+                pred = node;
+                if (compareTo(data, node) <= 0 && !follow(guard, PRED, pred, [=] { return node->pred.load(std::memory_order_acquire); })) continue;
+            }
+
+            slot = cursorAfter(slot, 1);
+            return pin(guard, slot, pred);
+        }
+    }
+
+    /**
+    * The body of insertBatch, also behind insert(hint, data): finger is where the previous key went, and
+    * slot protects it in guard; both are left at the last key handled. */
+    template<typename ForwardIt>
+    std::size_t insertSorted(ForwardIt first, ForwardIt last, Guard &guard, std::size_t &slot, ConcurrentNode<T> *&finger)
+    {
+        Backoff backoff;
+        std::size_t inserted = 0;
+        ConcurrentNode<T> *run[max_run];
+
+        while (first != last)
+        {
+            Key data = *first;
+            auto pred = batchWindow(data, finger, guard, slot);
+            finger = NULL;
+
+            ConcurrentNode<T> *succ;
+            if constexpr (Ordering::lock_free)
+            {
+                succ = pred;
+                if (!stepForward(guard, cursorAfter(slot, 1), succ) || isMarked(pred->succ.load(std::memory_order_acquire)))
+                {
+                    backOff(backoff);
+                    continue;
+                }
+            }
+            else
+            {
+                lockWith<Backoff>(pred->succ_lock);
+                if (!pred->valid.load(std::memory_order_relaxed) || compareTo(data, pred) <= 0)
+                {
+                    pred->succ_lock.unlock();
+                    continue;
+                }
+                succ = pred->succ.load(std::memory_order_relaxed);
+            }
+
+            int res = compareTo(data, succ);
+            if constexpr (Removal::leaves_tombstones)
+            {
+                if (res == 0 && setDeleted(succ, false))
+                {
+                    pred->succ_lock.unlock();
+                    ++inserted;
+                    ++first;
+                    finger = pred;
+                    continue;
+                }
+            }
+            if (res >= 0)
+            {
+                if constexpr (!Ordering::lock_free) pred->succ_lock.unlock();
+
+                if (res > 0 || !isMember(succ))
+                {
+                    // not data's window after all, or data's node is on its way out: walk on from pred
+                    if (res == 0) backOff(backoff);
+                    finger = pred;
+                    continue;
+                }
 
-#include "HolderMutex.h"
+                ++first; // already present
+                finger = pred;
+                continue;
+            }
 
-template<typename T>
-class ConcurrentAVLTree
-{
-    template<typename G>
-    struct ConcurrentNode
-    {
-        const G data; // immutable
-        bool valid = true;
-        ConcurrentNode<G> *left = NULL;
-        ConcurrentNode<G> *right = NULL;
-        ConcurrentNode<G> *parent = NULL;
-        ConcurrentNode<G> *pred = NULL;
-        ConcurrentNode<G> *succ = NULL;
+            auto end = runEnd(first, last, succ);
+            ConcurrentNode<T> *parent;
+            if constexpr (Ordering::lock_free)
+            {
+                parent = chooseParentLockFree(pred, succ);
+                if (!parent)
+                {
+                    backOff(backoff);
+                    continue;
+                }
+            }
+            else parent = chooseParent(pred, succ, pred->right.load(std::memory_order_relaxed) ? succ : pred);
 
-        int left_tree_height = 0;
-        int right_tree_height = 0;
+            std::size_t count = 0;
+            for (auto it = first; it != end; ++it, ++count)
+            {
+                run[count] = createNode(*it, count ? run[count - 1] : pred, succ, NULL);
+                if (count) run[count - 1]->succ.store(run[count], std::memory_order_relaxed);
+            }
+            int height;
+            auto subtree = buildSubtree(run, 0, count, parent, height);
+            if (count > 1) subtree->tree_lock.lock(); // before anyone can reach it, see attachSubtree
 
-        HolderMutex tree_lock;
-        HolderMutex succ_lock;
+            // protected before it is published, so it cannot be freed before we walk on from it; pred and
+            // succ keep the other two slots
+            auto last_slot = cursorAfter(slot, 2);
+            pin(guard, last_slot, run[count - 1]);
 
-        ConcurrentNode<G>(const G data, ConcurrentNode<G> *pred, ConcurrentNode<G> *succ, ConcurrentNode<G> *parent) :
-            data(data),
-            parent(parent),
-            pred(pred),
-            succ(succ)
-        {
-        }
-    };
+            if constexpr (Ordering::lock_free)
+            {
+                auto expected = succ;
+                if (!pred->succ.compare_exchange_strong(expected, run[0], std::memory_order_release, std::memory_order_relaxed))
+                {
+                    parent->tree_lock.unlock();
+                    if (count > 1) subtree->tree_lock.unlock();
+                    for (std::size_t i = 0; i < count; ++i)
+                        destroyNode(run[i]); // never published
+                    continue;
+                }
+            }
+            else
+            {
+                succ->pred.store(run[count - 1], std::memory_order_release);
+                pred->succ.store(run[0], std::memory_order_release);
+                pred->succ_lock.unlock();
+            }
 
-public:
-    ConcurrentAVLTree()
-    {
-        auto parent = new ConcurrentNode<T>(-100000, NULL, NULL, NULL);
-        _root = new ConcurrentNode<T>(100000, parent, parent, parent); // todo: change magic num
+            if (count > 1) attachSubtree(parent, subtree, parent == pred, guard);
+            else insertToTree(parent, subtree, parent == pred, guard);
+            inserted += count;
+            if constexpr (Removal::leaves_tombstones) _removal.addNodes(std::int64_t(count));
+            backoff = Backoff(); // waits for one run say nothing about the next
+            first = end;
+            finger = run[count - 1];
+            slot = last_slot;
+        }
 
-        parent->right = _root;
-        parent->succ = _root;
+        return inserted;
     }
 
-    ~ConcurrentAVLTree()
+    // the end of the run starting at first: strictly ascending keys below succ, at most max_run of them
+    template<typename ForwardIt>
+    ForwardIt runEnd(ForwardIt first, ForwardIt last, ConcurrentNode<T> *succ) const
     {
-        deleteTree(_root);
+        auto prev = first;
+        auto it = first;
+        std::size_t count = 1;
+        for (++it; it != last && count < max_run && lessKeys(*prev, *it) && compareTo(*it, succ) < 0; ++it, ++count)
+            prev = it;
+        return it;
     }
 
-    void print() const
+    /**
+    * Links run[lo, hi) into a perfectly balanced subtree under parent and returns its root, with its
+    * height in height. The nodes are not yet reachable, so plain relaxed stores do; publishing the
+    * subtree root with release makes them visible. */
+    ConcurrentNode<T>* buildSubtree(ConcurrentNode<T> **run, std::size_t lo, std::size_t hi, ConcurrentNode<T> *parent, int &height)
     {
-        printRecursive(_root);
+        if (lo == hi)
+        {
+            height = 0;
+            return NULL;
+        }
+
+        auto mid = lo + (hi - lo) / 2;
+        auto node = run[mid];
+        int left_height, right_height;
+        node->parent.store(parent, std::memory_order_relaxed);
+        node->left.store(buildSubtree(run, lo, mid, node, left_height), std::memory_order_relaxed);
+        node->right.store(buildSubtree(run, mid + 1, hi, node, right_height), std::memory_order_relaxed);
+        node->left_tree_height.store(left_height, std::memory_order_relaxed);
+        node->right_tree_height.store(right_height, std::memory_order_relaxed);
+
+        height = std::max(left_height, right_height) + 1;
+        return node;
     }
 
-    bool contains(T data) const
+    struct BuiltSubtree
+    {
+        ConcurrentNode<T> *root;
+        ConcurrentNode<T> *first; // least and greatest nodes, whose outer pred and succ are left to the caller
+        ConcurrentNode<T> *last;
+        int height;
+    };
+
+    /**
+    * buildFromSorted for first[lo, hi): the subtree rooted at the middle key, with its parent links,
+    * heights and the pred/succ links between its own nodes set. While threads > 1 the left half is
+    * built by a new thread, which runs on threads / 2 of them, unless the range is too small to bother. */
+    template<typename RandomIt>
+    BuiltSubtree buildSorted(RandomIt first, std::size_t lo, std::size_t hi, unsigned threads)
     {
-        auto node = search(data);
-        while (node->data > data) node = node->pred;
-        while (node->data < data) node = node->succ;
-        return (node->data == data) && node->valid;
+        if (lo == hi) return BuiltSubtree{NULL, NULL, NULL, 0};
+
+        auto mid = lo + (hi - lo) / 2;
+        BuiltSubtree left, right;
+        if (threads > 1 && hi - lo >= parallel_build_keys)
+        {
+            std::thread builder([&] { left = buildSorted(first, lo, mid, threads / 2); });
+            right = buildSorted(first, mid + 1, hi, threads - threads / 2);
+            builder.join();
+        }
+        else
+        {
+            left = buildSorted(first, lo, mid, 1);
+            right = buildSorted(first, mid + 1, hi, 1);
+        }
+
+        auto node = createNode(first[mid], left.last, right.first, NULL);
+        node->left.store(left.root, std::memory_order_relaxed);
+        node->right.store(right.root, std::memory_order_relaxed);
+        node->left_tree_height.store(left.height, std::memory_order_relaxed);
+        node->right_tree_height.store(right.height, std::memory_order_relaxed);
+
+        BuiltSubtree built{node, node, node, std::max(left.height, right.height) + 1};
+        if (left.root)
+        {
+            left.root->parent.store(node, std::memory_order_relaxed);
+            left.last->succ.store(node, std::memory_order_relaxed);
+            built.first = left.first;
+        }
+        if (right.root)
+        {
+            right.root->parent.store(node, std::memory_order_relaxed);
+            right.first->pred.store(node, std::memory_order_relaxed);
+            built.last = right.last;
+        }
+        return built;
     }
 
-    bool insert(T data)
+    enum RemoveOutcome
     {
-        while (true)
+        REMOVED,
+        ABSENT,
+        RETRY   // pred was no longer data's predecessor
+    };
+
+    /**
+    * Locked ordering: removes data's node, provided pred is still its predecessor in the list. node is
+    * a node already compared with data, res the result, which spares comparing it again. */
+    RemoveOutcome removeAfter(Key data, ConcurrentNode<T> *pred, ConcurrentNode<T> *node, int res, Guard &guard)
+    {
+        try
         {
-            auto node = search(data);
-            int res = data - node->data;
-            auto pred = (res > 0) ? node : node->pred;
+            lockWith<Backoff>(pred->succ_lock);
 
-            try
+            if (pred->valid.load(std::memory_order_relaxed))
             {
-                pred->succ_lock.lock();
-
-                if (pred->valid)
+                int pred_res = (pred == node) ? res : compareTo(data, pred);
+                if (pred_res > 0)
                 {
-                    auto pred_value = pred->data;
-                    int pred_res = (pred == node ? res : data - pred_value);
+                    auto succ = pred->succ.load(std::memory_order_relaxed);
+                    int res2 = (succ == node) ? res : compareTo(data, succ);
 
-                    if (pred_res > 0)
+                    if (res2 <= 0)
                     {
-                        auto succ = pred->succ;
-                        auto succ_value = succ->data;
-                        int res2 = (succ == node ? res : data - succ_value);
-                        if (res2 <= 0)
+                        if (res2 != 0)
                         {
-                            if (res2 == 0)
-                            {
-                                pred->succ_lock.unlock();
-                                return false;
-                            }
-
-                            auto parent = chooseParent(pred, succ, node);
-                            auto newNode = new ConcurrentNode<T>(data, pred, succ, parent);
+                            pred->succ_lock.unlock();
+                            return ABSENT;
+                        }
 
-                            succ->pred = newNode;
-                            pred->succ = newNode;
+                        if constexpr (Removal::leaves_tombstones)
+                        {
+                            bool buried = setDeleted(succ, true);
                             pred->succ_lock.unlock();
-                            insertToTree(parent, newNode, parent == pred);
-                            return true;
+                            return buried ? REMOVED : ABSENT;
                         }
+
+                        unlinkAfter(pred, succ, guard);
+                        return REMOVED;
                     }
                 }
-
-                pred->succ_lock.unlock();
-            }
-            catch (const std::exception &e)
-            {
-                std::cout << "Error insert: " << e.what() << std::endl;
-                pred->succ_lock.unlock();
-                return false;
             }
+            pred->succ_lock.unlock();
         }
 
-        // should never reach
-        return true;
+        catch (const std::exception& e)
+        {
+            std::cout << "Error remove: " << e.what() << std::endl;
+            pred->succ_lock.unlock();
+        }
+
+        return RETRY;
     }
 
+    /**
+    * Locked ordering: takes node, pred's successor, out of the list and the tree and retires it. Called
+    * holding pred->succ_lock, which it releases. */
+    void unlinkAfter(ConcurrentNode<T> *pred, ConcurrentNode<T> *node, Guard &guard)
+    {
+        lockWith<Backoff>(node->succ_lock);
+        auto successor = acquireTreeLocks(node, guard);
+        auto nodeParent = lockParent(node, guard);
+
+        node->valid.store(false, std::memory_order_release);
 
-    bool remove(T data)
+        auto node_succ = node->succ.load(std::memory_order_relaxed);
+        node_succ->pred.store(pred, std::memory_order_release);
+        pred->succ.store(node_succ, std::memory_order_release);
+        node->succ_lock.unlock();
+        pred->succ_lock.unlock();
+
+        removeFromTree(node, successor, nodeParent, guard);
+        _reclaimer.retire(node, &ConcurrentAVLTree::reclaimNode, this);
+    }
+
+    /**
+    * TombstoneRemoval, holding the succ_lock of node's predecessor: marks node deleted or revives it.
+    * @return false if it already was in that state. */
+    bool setDeleted(ConcurrentNode<T> *node, bool deleted)
     {
-        while (true)
+        if (node->deleted.load(std::memory_order_relaxed) == deleted) return false;
+
+        node->deleted.store(deleted, std::memory_order_release);
+        _removal.addTombstones(deleted ? 1 : -1);
+        return true;
+    }
+
+    // TombstoneRemoval: unlinks node if it is still a tombstone right after pred
+    bool unlinkTombstone(ConcurrentNode<T> *pred, ConcurrentNode<T> *node, Guard &guard)
+    {
+        lockWith<Backoff>(pred->succ_lock);
+        if (!pred->valid.load(std::memory_order_relaxed) || pred->succ.load(std::memory_order_relaxed) != node ||
+            !node->deleted.load(std::memory_order_relaxed))
         {
-            auto node = search(data);
-            int res = data - node->data;
-            auto pred = (res > 0) ? node : node->pred;
+            pred->succ_lock.unlock();
+            return false;
+        }
 
-            try
-            {
-                pred->succ_lock.lock();
+        _removal.addTombstones(-1);
+        _removal.addNodes(-1);
+        unlinkAfter(pred, node, guard);
+        return true;
+    }
 
-                if (pred->valid)
-                {
-                    auto pred_value = pred->data;
-                    int pred_res = (pred == node) ? res : data - pred_value;
-                    if (pred_res > 0)
-                    {
-                        auto succ = pred->succ;
-                        auto succ_value = succ->data;
-                        int res2 = (succ == node) ? res : data - succ_value;
+    // TombstoneRemoval: the purge a remove owes once tombstones are past the purge ratio
+    void purgeIfDue()
+    {
+        if constexpr (Removal::leaves_tombstones)
+            if (_removal.purgeDue()) purge();
+    }
 
-                        if (res2 <= 0)
-                        {
-                            if (res2 != 0)
-                            {
-                                pred->succ_lock.unlock();
-                                return false;
-                            }
+    /**
+    * Lock-free ordering. A node is a member while its succ is unmarked; remove marks it and, once the
+    * node is out of the physical tree, its remover alone unlinks it. Until then its succ is frozen:
+    * nothing is inserted behind a marked node, so the list and the tree agree on who follows it while
+    * its tree_locks are being acquired. Inserts and removes next to a marked node wait for that unlink.
+    *
+    * Every node a search visits was in the tree, hence linked, at some point during the operation, and
+    * a linked node's succ is either current or frozen, so a walk may start from any of them. */
+    ConcurrentNode<T>* findNodeLockFree(Key data, Guard &guard) const
+    {
+        ConcurrentNode<T> *pred, *curr;
+        std::uint64_t steps = 0;
+        _stats.count(CONTAINS_CALLS);
 
-                            succ->succ_lock.lock();
-                            auto successor = acquireTreeLocks(succ);
-                            auto succParent = lockParent(succ);
+        Backoff backoff;
+        while (!locate(data, guard, pred, curr, Stats::enabled ? &steps : NULL)) backOff(backoff);
+        _stats.count(CONTAINS_WALK_STEPS, steps);
 
-                            succ->valid = false;
+        return (compareTo(data, curr) == 0 && !isMarked(curr->succ.load(std::memory_order_acquire))) ? curr : NULL;
+    }
 
-                            auto succ_succ = succ->succ;
-                            succ_succ->pred = pred;
-                            pred->succ = succ_succ;
-                            succ->succ_lock.unlock();
-                            pred->succ_lock.unlock();
+    bool insertLockFree(Key data)
+    {
+        Backoff backoff;
+        Guard guard(_reclaimer);
+        ConcurrentNode<T> *node = NULL;
 
-                            removeFromTree(succ, successor, succParent);
-                            return true;
-                        }
-                    }
+        for (int attempt = 0; ; ++attempt)
+        {
+            if (attempt) _stats.count(INSERT_RETRIES);
+
+            ConcurrentNode<T> *pred, *succ;
+            if (!locate(data, guard, pred, succ))
+            {
+                backOff(backoff);
+                continue;
+            }
+
+            if (compareTo(data, succ) == 0)
+            {
+                if (!isMarked(succ->succ.load(std::memory_order_acquire)))
+                {
+                    if (node) destroyNode(node); // never published
+                    return false;
                 }
-                pred->succ_lock.unlock();
+
+                backOff(backoff);
+                continue;
             }
 
-            catch (const std::exception& e)
+            auto parent = isMarked(pred->succ.load(std::memory_order_acquire)) ? NULL : chooseParentLockFree(pred, succ);
+            if (!parent)
             {
-                std::cout << "Error remove: " << e.what() << std::endl;
-                pred->succ_lock.unlock();
+                backOff(backoff);
+                continue;
             }
+
+            if (!node) node = createNode(data, pred, succ, parent);
+            else
+            {
+                node->pred.store(pred, std::memory_order_relaxed);
+                node->succ.store(succ, std::memory_order_relaxed);
+                node->parent.store(parent, std::memory_order_relaxed);
+            }
+
+            auto expected = succ;
+            if (pred->succ.compare_exchange_strong(expected, node, std::memory_order_release, std::memory_order_relaxed))
+            {
+                insertToTree(parent, node, parent == pred, guard);
+                return true;
+            }
+
+            parent->tree_lock.unlock();
+        }
+    }
+
+    bool removeLockFree(Key data)
+    {
+        Backoff backoff;
+        Guard guard(_reclaimer);
+        ConcurrentNode<T> *pred, *node;
+
+        while (!locate(data, guard, pred, node))
+        {
+            _stats.count(REMOVE_RETRIES);
+            backOff(backoff);
+        }
+        if (compareTo(data, node) != 0) return false;
+
+        return removeNode(node, guard);
+    }
+
+    /**
+    * Lock-free ordering: removes node unless another remover marked it first. */
+    bool removeNode(ConcurrentNode<T> *node, Guard &guard)
+    {
+        auto succ = node->succ.load(std::memory_order_acquire);
+        do
+        {
+            if (isMarked(succ)) return false;
         }
+        while (!node->succ.compare_exchange_weak(succ, marked(succ), std::memory_order_acq_rel, std::memory_order_acquire));
+
+        auto successor = acquireTreeLocks(node, guard);
+        auto parent = lockParent(node, guard);
 
+        node->valid.store(false, std::memory_order_release);
+        removeFromTree(node, successor, parent, guard);
+
+        unlink(node, guard);
+        _reclaimer.retire(node, &ConcurrentAVLTree::reclaimNode, this);
         return true;
     }
 
-private:
-    ConcurrentNode<T> *_root;
+    /**
+    * Sets curr to the list node holding data, or else to the first one above it with pred -> curr the
+    * window data belongs in. When the tree path runs into data's node, curr is that node and pred is not
+    * walked up to it; otherwise succ links are walked from the last node below data on the path, and
+    * counted into walk_steps when given. immediate_pred always wants the window, so the search goes on
+    * past data's node to its in-order predecessor, from where the walk is short.
+    * Returns false when a validating reclaimer saw pred's link change under the walk, in which case curr
+    * may already be freed and the caller retries. */
+    bool locate(Key data, Guard &guard, ConcurrentNode<T> *&pred, ConcurrentNode<T> *&curr, std::uint64_t *walk_steps = NULL,
+                bool immediate_pred = false) const
+    {
+        if (immediate_pred) curr = search<true>(data, guard, &pred);
+        else
+        {
+            curr = search(data, guard, &pred);
+            if (compareTo(data, curr) == 0) return true;
+        }
+
+        return walkWindow(data, guard, pred, curr, walk_steps);
+    }
 
-    ConcurrentNode<T>* search(T data) const
+    // the succ walk of locate from pred, the last node below data on a search path
+    bool walkWindow(Key data, Guard &guard, ConcurrentNode<T> *&pred, ConcurrentNode<T> *&curr, std::uint64_t *walk_steps) const
     {
-        ConcurrentNode<T> *node = _root;
-        ConcurrentNode<T> *child;
+        std::size_t slot = WALK_A;
 
         while (true)
         {
-            auto curr_data = node->data;
-            if (curr_data == data) break;
+            curr = guard.protect(slot, [=] { return unmarked(pred->succ.load(std::memory_order_acquire)); });
+            if (Reclaimer::needs_validation && pred->succ.load(std::memory_order_acquire) != curr) return false;
+            if (compareTo(data, curr) <= 0) return true;
+
+            if constexpr (Stats::enabled) if (walk_steps) ++*walk_steps;
+            pred = curr;
+            slot = (slot == WALK_A) ? WALK_B : WALK_A;
+        }
+    }
 
-            child = (curr_data < data) ? node->right : node->left;
+    /**
+    * Unlinks a marked node whose physical removal is done. The node is off the tree path and the only
+    * one with its key, so locate walks onto it; a CAS failure means its pred is itself marked, or an
+    * insert just landed in between. */
+    void unlink(ConcurrentNode<T> *node, Guard &guard)
+    {
+        Backoff backoff;
+        auto next = unmarked(node->succ.load(std::memory_order_relaxed));
 
-            if (child == NULL) break;
+        while (true)
+        {
+            ConcurrentNode<T> *pred, *curr;
+            if (locate(node->data, guard, pred, curr))
+            {
+                auto expected = node;
+                if (pred->succ.compare_exchange_strong(expected, next, std::memory_order_release, std::memory_order_relaxed)) return;
+            }
 
-            node = child;
+            backOff(backoff);
         }
+    }
 
-        return node;
+    /**
+    * Lock-free counterpart of the succ a remover holds under succ_lock. node is marked, so its succ chain
+    * is frozen up to the first node still in the tree, which is node's in-order successor; none of the
+    * nodes on the chain can be unlinked, let alone freed, before node is. */
+    ConcurrentNode<T>* physicalSuccessor(ConcurrentNode<T> *node) const
+    {
+        auto succ = unmarked(node->succ.load(std::memory_order_acquire));
+        while (!succ->valid.load(std::memory_order_acquire))
+            succ = unmarked(succ->succ.load(std::memory_order_acquire));
+
+        return succ;
+    }
+
+    /**
+    * Locks and returns whichever of pred and succ can take the new node as a child, or NULL if neither
+    * can right now. Checking valid under the lock keeps a node already cut from the tree from being used. */
+    ConcurrentNode<T>* chooseParentLockFree(ConcurrentNode<T> *pred, ConcurrentNode<T> *succ)
+    {
+        lockWith<Backoff>(pred->tree_lock);
+        if (pred->valid.load(std::memory_order_relaxed) && !pred->right.load(std::memory_order_relaxed)) return pred;
+        pred->tree_lock.unlock();
+
+        lockWith<Backoff>(succ->tree_lock);
+        if (succ->valid.load(std::memory_order_relaxed) && !succ->left.load(std::memory_order_relaxed)) return succ;
+        succ->tree_lock.unlock();
+
+        return NULL;
     }
 
     ConcurrentNode<T>* chooseParent(ConcurrentNode<T> *pred, ConcurrentNode<T> *succ, ConcurrentNode<T> *node)
     {
+        Backoff backoff;
         auto candidate = (node == pred || node == succ) ? node : pred;
 
         while (true)
         {
-            candidate->tree_lock.lock();
+            lockWith<Backoff>(candidate->tree_lock);
 
             if (candidate == pred)
             {
-                if (!candidate->right) return candidate;
+                if (!candidate->right.load(std::memory_order_relaxed)) return candidate;
                 candidate->tree_lock.unlock();
                 candidate = succ;
             }
             else
             {
-                if (!candidate->left) return candidate;
+                if (!candidate->left.load(std::memory_order_relaxed)) return candidate;
                 candidate->tree_lock.unlock();
                 candidate = pred;
             }
 
-            std::this_thread::yield();
+            backOff(backoff);
         }
 
         return NULL;
     }
 
-    void insertToTree(ConcurrentNode<T>* parent, ConcurrentNode<T>* new_node, bool is_right)
+    void insertToTree(ConcurrentNode<T>* parent, ConcurrentNode<T>* new_node, bool is_right, Guard &guard)
     {
+        if constexpr (!Balancing::rebalances)
+        {
+            (is_right ? parent->right : parent->left).store(new_node, std::memory_order_release);
+            deferFix(parent);
+            parent->tree_lock.unlock();
+            return;
+        }
+
         if (is_right)
         {
-            parent->right = new_node;
-            parent->right_tree_height = 1;
+            parent->right.store(new_node, std::memory_order_release);
+            parent->right_tree_height.store(1, std::memory_order_relaxed);
         }
         else
         {
-            parent->left = new_node;
-            parent->left_tree_height = 1;
+            parent->left.store(new_node, std::memory_order_release);
+            parent->left_tree_height.store(1, std::memory_order_relaxed);
         }
         if (parent != _root)
         {
-            auto grand_parent = lockParent(parent);
-            rebalance(grand_parent, parent, grand_parent->left == parent);
+            auto grand_parent = lockParent(parent, guard);
+            rebalance(grand_parent, parent, grand_parent->left.load(std::memory_order_relaxed) == parent, guard);
         }
         else parent->tree_lock.unlock();
     }
 
-    ConcurrentNode<T>* acquireTreeLocks(ConcurrentNode<T>* node)
+    /**
+    * insertToTree for a subtree built by insertBatch. Unlike a leaf it can put parent itself out of
+    * balance, so rebalancing starts at parent, with the subtree root locked by the caller as the child;
+    * parent's height for that side is still 0 and gets updated there. */
+    void attachSubtree(ConcurrentNode<T>* parent, ConcurrentNode<T>* subtree, bool is_right, Guard &guard)
+    {
+        (is_right ? parent->right : parent->left).store(subtree, std::memory_order_release);
+        settle(parent, subtree, !is_right, guard);
+    }
+
+    ConcurrentNode<T>* acquireTreeLocks(ConcurrentNode<T>* node, Guard &guard)
     {
+        Backoff backoff;
+
         while (true)
         {
-            node->tree_lock.lock();
-            auto right = node->right;
-            auto left = node->left;
+            lockWith<Backoff>(node->tree_lock);
+            auto right = node->right.load(std::memory_order_relaxed);
+            auto left = node->left.load(std::memory_order_relaxed);
 
             if (!right || !left)
             {
                 if (right && !right->tree_lock.try_lock())
                 {
+                    _stats.count(TRY_LOCK_FAILURES);
                     node->tree_lock.unlock();
-                    std::this_thread::yield();
+                    backOff(backoff);
                     continue;
                 }
                 if (left && !left->tree_lock.try_lock())
                 {
+                    _stats.count(TRY_LOCK_FAILURES);
                     node->tree_lock.unlock();
-                    std::this_thread::yield();
+                    backOff(backoff);
                     continue;
                 }
                 return NULL;
             }
 
-            auto succ = node->succ;
-            auto parent = succ->parent;
+            // succ cannot be removed while we hold node->succ_lock (or, lock-free, while node is marked), but its parent can
+            auto succ = Ordering::lock_free ? physicalSuccessor(node) : node->succ.load(std::memory_order_relaxed);
+            auto parent = guard.protect(SUCC_PARENT, [=] { return succ->parent.load(std::memory_order_acquire); });
             if (parent != node)
             {
                 if (!parent->tree_lock.try_lock())
                 {
+                    _stats.count(TRY_LOCK_FAILURES);
                     node->tree_lock.unlock();
-                    std::this_thread::yield();
+                    backOff(backoff);
                     continue;
                 }
-                else if (parent != succ->parent || !parent->valid)
+                else if (parent != succ->parent.load(std::memory_order_relaxed) || !parent->valid.load(std::memory_order_relaxed))
                 {
                     parent->tree_lock.unlock();
                     node->tree_lock.unlock();
-                    std::this_thread::yield();
+                    backOff(backoff);
                     continue;
                 }
             }
 
             if (!succ->tree_lock.try_lock())
             {
+                _stats.count(TRY_LOCK_FAILURES);
+                node->tree_lock.unlock();
+                if (parent != node)
+                {
+                    parent->tree_lock.unlock();
+                }
+                backOff(backoff);
+                continue;
+            }
+
+            if (Ordering::lock_free && !succ->valid.load(std::memory_order_relaxed))
+            {
+                succ->tree_lock.unlock();
                 node->tree_lock.unlock();
                 if (parent != node)
                 {
                     parent->tree_lock.unlock();
                 }
-                std::this_thread::yield();
+                backOff(backoff);
                 continue;
             }
 
-            auto succ_right_child = succ->right;
+            auto succ_right_child = succ->right.load(std::memory_order_relaxed);
 
             if (succ_right_child && !succ_right_child->tree_lock.try_lock())
             {
+                _stats.count(TRY_LOCK_FAILURES);
                 node->tree_lock.unlock();
                 succ->tree_lock.unlock();
                 if (parent != node)
                 {
                     parent->tree_lock.unlock();
                 }
-                std::this_thread::yield();
+                backOff(backoff);
                 continue;
             }
 
@@ -323,39 +2348,42 @@ private:
         }
     }
 
-    void removeFromTree(ConcurrentNode<T>* node, ConcurrentNode<T>* succ, ConcurrentNode<T>* parent)
+    void removeFromTree(ConcurrentNode<T>* node, ConcurrentNode<T>* succ, ConcurrentNode<T>* parent, Guard &guard)
     {
         if (!succ)
         {
-            auto right = node->right;
-            auto child = (right == NULL) ? node->left : right;
+            auto right = node->right.load(std::memory_order_relaxed);
+            auto child = (right == NULL) ? node->left.load(std::memory_order_relaxed) : right;
 
             bool left = updateChild(parent, node, child);
             node->tree_lock.unlock();
-            rebalance(parent, child, left);
+            settle(parent, child, left, guard);
             return;
         }
 
-        auto old_parent = succ->parent;
-        auto old_right = succ->right;
+        // succ is re-locked below after rebalance has dropped its lock, so keep it published until then
+        guard.protect(REPLACEMENT, [=] { return succ; });
+
+        auto old_parent = succ->parent.load(std::memory_order_relaxed);
+        auto old_right = succ->right.load(std::memory_order_relaxed);
         updateChild(old_parent, succ, old_right);
 
-        succ->left_tree_height = node->left_tree_height;
-        succ->right_tree_height = node->right_tree_height;
-        auto left = node->left;
-        auto right = node->right;
-        succ->parent = parent;
-        succ->left = node->left;
-        succ->right = node->right;
-        left->parent = succ;
+        succ->left_tree_height.store(node->left_tree_height.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        succ->right_tree_height.store(node->right_tree_height.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        auto left = node->left.load(std::memory_order_relaxed);
+        auto right = node->right.load(std::memory_order_relaxed);
+        succ->parent.store(parent, std::memory_order_release);
+        succ->left.store(left, std::memory_order_release);
+        succ->right.store(right, std::memory_order_release);
+        left->parent.store(succ, std::memory_order_release);
 
-        if (node->right) right->parent = succ;
+        if (right) right->parent.store(succ, std::memory_order_release);
 
-        if (parent->left == node) parent->left = succ;
-        else parent->right = succ;
+        if (parent->left.load(std::memory_order_relaxed) == node) parent->left.store(succ, std::memory_order_release);
+        else parent->right.store(succ, std::memory_order_release);
 
         bool is_left = (old_parent != node);
-        bool violated = abs(getBalanceFactor(succ)) >= 2;
+        bool violated = Balancing::rebalances && abs(getBalanceFactor(succ)) >= 2;
 
         if (!is_left) old_parent = succ;
         else succ->tree_lock.unlock();
@@ -363,46 +2391,48 @@ private:
         node->tree_lock.unlock();
         parent->tree_lock.unlock();
 
-        rebalance(old_parent, old_right, is_left);
+        settle(old_parent, old_right, is_left, guard);
 
         if (violated)
         {
-            succ->tree_lock.lock();
+            lockWith<Backoff>(succ->tree_lock);
             int bf = getBalanceFactor(succ);
-            if (succ->valid && abs(bf) >= 2) rebalance(succ, NULL, bf >= 2 ? false : true);
+            if (succ->valid.load(std::memory_order_relaxed) && abs(bf) >= 2) rebalance(succ, NULL, bf >= 2 ? false : true, guard);
             else succ->tree_lock.unlock();
         }
     }
 
     bool updateChild(ConcurrentNode<T>* parent, ConcurrentNode<T>* old_child, ConcurrentNode<T>* new_child)
     {
-        if (new_child) new_child->parent = parent;
-        bool left = parent->left == old_child;
-        if (left) parent->left = new_child;
-        else parent->right = new_child;
+        if (new_child) new_child->parent.store(parent, std::memory_order_release);
+        bool left = parent->left.load(std::memory_order_relaxed) == old_child;
+        if (left) parent->left.store(new_child, std::memory_order_release);
+        else parent->right.store(new_child, std::memory_order_release);
         return left;
     }
 
-    ConcurrentNode<T>* lockParent(ConcurrentNode<T>* node)
+    ConcurrentNode<T>* lockParent(ConcurrentNode<T>* node, Guard &guard)
     {
-        auto parent = node->parent;
+        Backoff backoff;
+        auto parent = guard.protect(LOCK_PARENT, [=] { return node->parent.load(std::memory_order_acquire); });
 
         try
         {
-            parent->tree_lock.lock();
+            lockWith<Backoff>(parent->tree_lock);
 
-            while (node->parent != parent || !parent->valid)
+            while (node->parent.load(std::memory_order_relaxed) != parent || !parent->valid.load(std::memory_order_relaxed))
             {
+                _stats.count(PARENT_RELOCKS);
                 parent->tree_lock.unlock();
-                parent = node->parent;
+                parent = guard.protect(LOCK_PARENT, [=] { return node->parent.load(std::memory_order_acquire); });
 
-                while (!parent->valid)
+                while (!parent->valid.load(std::memory_order_acquire))
                 {
-                    std::this_thread::yield();
-                    parent = node->parent;
+                    backOff(backoff);
+                    parent = guard.protect(LOCK_PARENT, [=] { return node->parent.load(std::memory_order_acquire); });
                 }
 
-                parent->tree_lock.lock();
+                lockWith<Backoff>(parent->tree_lock);
             }
 
             return parent;
@@ -416,6 +2446,101 @@ private:
         }
     }
 
+    // rebalance, or otherwise just the unlocking it ends with, after logging node's fix under DeferredBalancing
+    void settle(ConcurrentNode<T> *node, ConcurrentNode<T> *child, bool is_left, Guard &guard)
+    {
+        if constexpr (Balancing::rebalances) rebalance(node, child, is_left, guard);
+        else
+        {
+            deferFix(node);
+            unlockRebalance(node, child, NULL);
+        }
+    }
+
+    /**
+    * DeferredBalancing: logs that node's heights may no longer match its children, node being one the
+    * caller has just relinked a child of and still holds locked. */
+    void deferFix(ConcurrentNode<T> *node)
+    {
+        if constexpr (Balancing::deferred)
+            if (node != _root) _pending.record(Fix{node->data, node});
+    }
+
+    // DeferredBalancing: the cooperative part of maintenance, at the start of every update
+    void keepBudget()
+    {
+        if constexpr (Balancing::deferred)
+            if (_pending.pending() >= _imbalance_budget.load(std::memory_order_relaxed)) applyFixes(ThreadRegistry::index());
+    }
+
+    /**
+    * DeferredBalancing: applies the fixes the thread at index has logged, in key order so that fixes
+    * close together in the tree share the upper part of their climb, and each node once.
+    * @return the number of fixes applied. */
+    std::size_t applyFixes(std::size_t index)
+    {
+        // kept per thread so that neither it nor the log it is swapped with lose their capacity
+        thread_local std::vector<Fix> fixes;
+        _pending.take(index, fixes);
+
+        std::sort(fixes.begin(), fixes.end(), [this](const Fix &a, const Fix &b) { return lessKeys(a.key, b.key); });
+        fixes.erase(std::unique(fixes.begin(), fixes.end(), [](const Fix &a, const Fix &b) { return a.node == b.node; }), fixes.end());
+
+        Guard guard(_reclaimer);
+        for (auto &fix : fixes)
+            applyFix(fix, guard);
+        return fixes.size();
+    }
+
+    /**
+    * DeferredBalancing: recomputes the heights of the fix's node from its children's and rebalances from
+    * there: from the node itself if it is out of balance, else from its parent if its height changed, as
+    * an eager update would have. The children's heights are read without their locks; one that is stale
+    * has a fix of its own pending, whose climb passes here again.
+    * If the node has left the tree since, the nodes that were above it are on the search path for its
+    * key, so the fix goes to the node that search ends at and climbs from it all the way to the top. */
+    void applyFix(const Fix &fix, Guard &guard)
+    {
+        Backoff backoff;
+
+        while (true)
+        {
+            auto node = search(fix.key, guard);
+            if (node == _root) return;
+            ConcurrentNode<T> *climb_to = (node == fix.node) ? NULL : _root;
+
+            lockWith<Backoff>(node->tree_lock);
+            if (!node->valid.load(std::memory_order_relaxed))
+            {
+                node->tree_lock.unlock();
+                continue;
+            }
+
+            bool changed = refreshHeights(node);
+            int bf = getBalanceFactor(node);
+
+            if (abs(bf) >= 2)
+            {
+                auto child = (bf >= 2 ? node->left : node->right).load(std::memory_order_relaxed);
+                if (!child->tree_lock.try_lock())
+                {
+                    _stats.count(TRY_LOCK_FAILURES);
+                    node->tree_lock.unlock();
+                    backOff(backoff);
+                    continue;
+                }
+                rebalance(node, child, bf >= 2, guard, climb_to);
+            }
+            else if (changed || climb_to)
+            {
+                auto parent = lockParent(node, guard);
+                rebalance(parent, node, parent->left.load(std::memory_order_relaxed) == node, guard, climb_to);
+            }
+            else node->tree_lock.unlock();
+            return;
+        }
+    }
+
     void unlockRebalance(ConcurrentNode<T>* node, ConcurrentNode<T>* child, ConcurrentNode<T>* parent)
     {
         if (child && child->tree_lock.owns_lock()) child->tree_lock.unlock();
@@ -425,82 +2550,104 @@ private:
 
     int getBalanceFactor(ConcurrentNode<T>* node)
     {
-        return node->left_tree_height - node->right_tree_height;
+        return node->left_tree_height.load(std::memory_order_relaxed) - node->right_tree_height.load(std::memory_order_relaxed);
     }
 
     bool updateHeight(ConcurrentNode<T> *child, ConcurrentNode<T> *node, bool is_left)
     {
-        int new_height = (child == NULL) ? 0 : std::max(child->left_tree_height, child->right_tree_height) + 1;
-        int old_height = is_left ? node->left_tree_height : node->right_tree_height;
+        int new_height = (child == NULL) ? 0 : std::max(child->left_tree_height.load(std::memory_order_relaxed), child->right_tree_height.load(std::memory_order_relaxed)) + 1;
+        int old_height = is_left ? node->left_tree_height.load(std::memory_order_relaxed) : node->right_tree_height.load(std::memory_order_relaxed);
 
         if (new_height == old_height) return false;
 
         if (is_left)
-            node->left_tree_height = new_height;
+            node->left_tree_height.store(new_height, std::memory_order_relaxed);
         else
-            node->right_tree_height = new_height;
+            node->right_tree_height.store(new_height, std::memory_order_relaxed);
 
         return true;
     }
 
-    ConcurrentNode<T>* restart(ConcurrentNode<T>* node, ConcurrentNode<T>* parent)
+    /**
+    * updateHeight for both of node's sides, which node's lock fixes; their children may be unlocked.
+    * DeferredBalancing calls it on every node rebalance reads heights from, since a stale height there
+    * could claim a child or grandchild the rotation then finds missing, or be copied by rotate into a
+    * node whose own fix has already run. */
+    bool refreshHeights(ConcurrentNode<T> *node)
+    {
+        bool changed = updateHeight(node->left.load(std::memory_order_relaxed), node, true);
+        return updateHeight(node->right.load(std::memory_order_relaxed), node, false) || changed;
+    }
+
+    ConcurrentNode<T>* restart(ConcurrentNode<T>* node, ConcurrentNode<T>* parent, Guard &guard)
     {
+        _stats.count(RESTARTS);
+        Backoff backoff;
+
+        // node is still locked here, so publishing it keeps it alive across the unlocked window below
+        guard.protect(RELOCK, [=] { return node; });
         if (parent) parent->tree_lock.unlock();
 
         node->tree_lock.unlock();
-        std::this_thread::yield();
+        backOff(backoff);
         while (true)
         {
-            node->tree_lock.lock();
-            if (!node->valid)
+            lockWith<Backoff>(node->tree_lock);
+            if (!node->valid.load(std::memory_order_relaxed))
             {
                 node->tree_lock.unlock();
                 return NULL;
             }
 
-            auto child = getBalanceFactor(node) >= 2 ? node->left : node->right;
+            // deferred heights may have gone stale while node was unlocked, and a stale side can be empty
+            if constexpr (Balancing::deferred) refreshHeights(node);
+            auto child = getBalanceFactor(node) >= 2 ? node->left.load(std::memory_order_relaxed) : node->right.load(std::memory_order_relaxed);
             if (child == NULL) return NULL;
             if (child->tree_lock.try_lock()) return child;
+            _stats.count(TRY_LOCK_FAILURES);
             node->tree_lock.unlock();
-            std::this_thread::yield();
+            backOff(backoff);
         }
     }
 
     void rotate(ConcurrentNode<T>* child, ConcurrentNode<T>* node, ConcurrentNode<T>* parent, bool left)
     {
-        if (parent->left == node)
-            parent->left = child;
+        if (parent->left.load(std::memory_order_relaxed) == node)
+            parent->left.store(child, std::memory_order_release);
         else
-            parent->right = child;
+            parent->right.store(child, std::memory_order_release);
 
-        child->parent = parent;
-        node->parent = child;
-        auto grand_child = left ? child->left : child->right;
+        child->parent.store(parent, std::memory_order_release);
+        node->parent.store(child, std::memory_order_release);
+        auto grand_child = left ? child->left.load(std::memory_order_relaxed) : child->right.load(std::memory_order_relaxed);
         if (left)
         {
-            node->right = grand_child;
+            node->right.store(grand_child, std::memory_order_release);
             if (grand_child != NULL)
-                grand_child->parent = node;
+                grand_child->parent.store(node, std::memory_order_release);
 
-            child->left = node;
-            node->right_tree_height = child->left_tree_height;
-            child->left_tree_height = std::max(node->left_tree_height, node->right_tree_height) + 1;
+            child->left.store(node, std::memory_order_release);
+            node->right_tree_height.store(child->left_tree_height.load(std::memory_order_relaxed), std::memory_order_relaxed);
+            child->left_tree_height.store(std::max(node->left_tree_height.load(std::memory_order_relaxed), node->right_tree_height.load(std::memory_order_relaxed)) + 1, std::memory_order_relaxed);
         }
         else
         {
-            node->left = grand_child;
+            node->left.store(grand_child, std::memory_order_release);
             if (grand_child != NULL)
-                grand_child->parent = node;
+                grand_child->parent.store(node, std::memory_order_release);
 
-            child->right = node;
-            node->left_tree_height = child->right_tree_height;
-            child->right_tree_height = std::max(node->left_tree_height, node->right_tree_height) + 1;
+            child->right.store(node, std::memory_order_release);
+            node->left_tree_height.store(child->right_tree_height.load(std::memory_order_relaxed), std::memory_order_relaxed);
+            child->right_tree_height.store(std::max(node->left_tree_height.load(std::memory_order_relaxed), node->right_tree_height.load(std::memory_order_relaxed)) + 1, std::memory_order_relaxed);
         }
     }
 
-    void rebalance(ConcurrentNode<T> *node, ConcurrentNode<T> *child, bool is_left)
+    // climb_to: a node the climb may not stop before reaching, _root to go all the way up
+    void rebalance(ConcurrentNode<T> *node, ConcurrentNode<T> *child, bool is_left, Guard &guard, ConcurrentNode<T> *climb_to = NULL)
     {
         ConcurrentNode<T> *parent = NULL;
+        // climb_to is also set when a node rotated down has to be fixed again from below, to the parent
+        // it was rotated under: the nodes rotated in between carry heights that parent has not seen yet
 
         if (node == _root)
         {
@@ -512,10 +2659,12 @@ private:
         {
             while (node != _root)
             {
-                bool update_height = updateHeight(child, node, is_left);
+                bool update_height = Balancing::deferred ? refreshHeights(node) : updateHeight(child, node, is_left);
                 int bf = getBalanceFactor(node);
 
-                if (!update_height && abs(bf) < 2)
+                if (node == climb_to) climb_to = NULL;
+
+                if (!update_height && abs(bf) < 2 && !climb_to)
                 {
                     unlockRebalance(node, child, parent);
                     return;
@@ -528,18 +2677,19 @@ private:
                         if (child != NULL)
                             child->tree_lock.unlock();
 
-                        child = is_left ? node->right : node->left;
+                        child = is_left ? node->right.load(std::memory_order_relaxed) : node->left.load(std::memory_order_relaxed);
                         if (!child->tree_lock.try_lock())
                         {
-                            child = restart(node, parent);
+                            _stats.count(TRY_LOCK_FAILURES);
+                            child = restart(node, parent, guard);
                             if (!node->tree_lock.owns_lock())
                             {
-                                unlockRebalance(node, child, parent);
+                                unlockRebalance(node, child, NULL); // restart already released parent
                                 return;
                             }
 
                             parent = NULL;
-                            is_left = node->left == child;
+                            is_left = node->left.load(std::memory_order_relaxed) == child;
                             bf = getBalanceFactor(node);
                             continue;
                         }
@@ -547,38 +2697,47 @@ private:
                         is_left = !is_left;
                     }
 
+                    if constexpr (Balancing::deferred) refreshHeights(child);
                     if ((is_left && getBalanceFactor(child) < 0) || (!is_left && getBalanceFactor(child) > 0))
                     {
                         // todo : test
-                        ConcurrentNode<T> *grand_child = is_left ? child->right : child->left;
+                        ConcurrentNode<T> *grand_child = is_left ? child->right.load(std::memory_order_relaxed) : child->left.load(std::memory_order_relaxed);
                         if (!grand_child->tree_lock.try_lock())
                         {
+                            _stats.count(TRY_LOCK_FAILURES);
                             child->tree_lock.unlock();
-                            child = restart(node, parent);
+                            child = restart(node, parent, guard);
                             if (!node->tree_lock.owns_lock())
                             {
-                                unlockRebalance(node, child, parent);
+                                unlockRebalance(node, child, NULL); // restart already released parent
                                 return;
                             }
                             parent = NULL;
-                            is_left = node->left == child;
+                            is_left = node->left.load(std::memory_order_relaxed) == child;
                             bf = getBalanceFactor(node);
                             continue;
                         }
 
+                        if constexpr (Balancing::deferred) refreshHeights(grand_child);
                         rotate(grand_child, child, node, is_left);
+                        // with heights that were stale, child can end up out of balance, which nothing below revisits
+                        if constexpr (Balancing::deferred)
+                            if (abs(getBalanceFactor(child)) >= 2) deferFix(child);
                         child->tree_lock.unlock();
                         child = grand_child;
+                        _stats.count(DOUBLE_ROTATIONS);
                     }
+                    else _stats.count(SINGLE_ROTATIONS);
 
                     if (parent == NULL)
-                        parent = lockParent(node);
+                        parent = lockParent(node, guard);
 
                     rotate(child, node, parent, !is_left);
                     bf = getBalanceFactor(node);
 
                     if (bf >= 2 || bf <= -2)
                     {
+                        if (!climb_to) climb_to = parent;
                         parent->tree_lock.unlock();
                         parent = child;
                         child = NULL;
@@ -589,15 +2748,15 @@ private:
                     ConcurrentNode<T> *temp = child;
                     child = node;
                     node = temp;
-                    is_left = node->left == child;
+                    is_left = node->left.load(std::memory_order_relaxed) == child;
                     bf = getBalanceFactor(node);
                 }
 
                 if (child) child->tree_lock.unlock();
 
                 child = node;
-                node = (parent && parent->tree_lock.owns_lock()) ? parent : lockParent(node);
-                is_left = node->left == child;
+                node = (parent && parent->tree_lock.owns_lock()) ? parent : lockParent(node, guard);
+                is_left = node->left.load(std::memory_order_relaxed) == child;
                 parent = NULL;
             }
         }
@@ -614,18 +2773,31 @@ private:
     {
         if (!root) return;
 
-        printRecursive(root->left);
+        printRecursive(root->left.load(std::memory_order_relaxed));
         std::cout << root->data << " ";
-        printRecursive(root->right);
+        printRecursive(root->right.load(std::memory_order_relaxed));
     }
 
+    // iterative: under NoBalancing the tree can be as deep as it has nodes
     void deleteTree(ConcurrentNode<T> *root)
     {
-        if (!root) return;
+        std::vector<ConcurrentNode<T>*> pending;
+        if (root) pending.push_back(root);
 
-        deleteTree(root->left);
-        deleteTree(root->right);
-
-        delete root;
+        while (!pending.empty())
+        {
+            auto node = pending.back();
+            pending.pop_back();
+            if (auto left = node->left.load(std::memory_order_relaxed)) pending.push_back(left);
+            if (auto right = node->right.load(std::memory_order_relaxed)) pending.push_back(right);
+            destroyNode(node);
+        }
     }
 };
+
+/**
+* The paper's unbalanced concurrent BST: ConcurrentAVLTree without heights or rotations (see NoBalancing). */
+template<typename T, typename Reclaimer = EpochReclamation, typename Lock = SpinLock, typename Ordering = LockedOrdering,
+         typename Stats = NoStats, typename Layout = PackedLayout, typename Allocator = PoolAllocation,
+         typename Compare = std::less<T>, typename Removal = UnlinkRemoval, typename Backoff = YieldBackoff>
+using ConcurrentBST = ConcurrentAVLTree<T, Reclaimer, Lock, Ordering, Stats, Layout, Allocator, Compare, NoBalancing, Removal, Backoff>;
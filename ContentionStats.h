@@ -0,0 +1,108 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "ThreadRegistry.h"
+
+/**
+* Contention statistics policies for ConcurrentAVLTree. NoStats (the default) has empty inline hooks and
+* compiles out entirely; ContentionStats keeps one cache-line aligned counter record per thread, written
+* only by its owner, and sums them into a snapshot on demand. */
+
+enum ContentionEvent
+{
+    INSERT_RETRIES,         // passes of insert's retry loop after the first
+    REMOVE_RETRIES,         // passes of remove's retry loop after the first
+    TRY_LOCK_FAILURES,      // tree_lock try_lock failures in acquireTreeLocks, restart and rebalance
+    YIELDS,                 // backoff waits on another thread (see Backoff.h)
+    RESTARTS,               // rebalance restarts after failing to lock a child
+    SINGLE_ROTATIONS,
+    DOUBLE_ROTATIONS,
+    PARENT_RELOCKS,         // lockParent passes that found the parent changed or removed
+    CONTAINS_CALLS,
+    CONTAINS_WALK_STEPS,    // pred/succ links contains followed after its tree search
+    CONTENTION_EVENT_COUNT
+};
+
+const char* const contention_event_names[] = {
+    "insert_retries", "remove_retries", "try_lock_failures", "yields", "restarts",
+    "single_rotations", "double_rotations", "parent_relocks", "contains_calls", "contains_walk_steps"
+};
+
+struct ContentionSnapshot
+{
+    std::uint64_t counts[CONTENTION_EVENT_COUNT] = {};
+
+    std::uint64_t operator[](ContentionEvent event) const { return counts[event]; }
+
+    bool empty() const
+    {
+        for (auto count : counts)
+            if (count) return false;
+        return true;
+    }
+
+    ContentionSnapshot& operator+=(const ContentionSnapshot &other)
+    {
+        for (std::size_t i = 0; i < CONTENTION_EVENT_COUNT; ++i)
+            counts[i] += other.counts[i];
+        return *this;
+    }
+};
+
+class NoStats
+{
+public:
+    static const bool enabled = false;
+
+    void count(ContentionEvent, std::uint64_t = 1) {}
+    ContentionSnapshot snapshot() const { return ContentionSnapshot(); }
+};
+
+class ContentionStats
+{
+public:
+    static const bool enabled = true;
+
+    ContentionStats() = default;
+    ContentionStats(const ContentionStats &) = delete;
+    ContentionStats& operator=(const ContentionStats &) = delete;
+
+    void count(ContentionEvent event, std::uint64_t n = 1)
+    {
+        // only the owning thread writes its record, so a plain load and store is enough
+        auto &counter = m_records[ThreadRegistry::index()].counts[event];
+        counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    /**
+    * Sums every thread's counters. Taken while the tree is in use, each counter is current as of some
+    * moment during the call, but they are not read at one instant. */
+    ContentionSnapshot snapshot() const
+    {
+        ContentionSnapshot result;
+        auto count = ThreadRegistry::highWater();
+
+        for (std::size_t i = 0; i < count; ++i)
+            for (std::size_t e = 0; e < CONTENTION_EVENT_COUNT; ++e)
+                result.counts[e] += m_records[i].counts[e].load(std::memory_order_relaxed);
+
+        return result;
+    }
+
+private:
+    struct alignas(64) Record
+    {
+        std::atomic<std::uint64_t> counts[CONTENTION_EVENT_COUNT];
+
+        Record()
+        {
+            for (auto &counter : counts)
+                counter.store(0, std::memory_order_relaxed);
+        }
+    };
+
+    Record m_records[ThreadRegistry::max_threads];
+};
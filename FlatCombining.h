@@ -0,0 +1,185 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <type_traits>
+#include <vector>
+
+#include "ConcurrentBST.h"
+
+/**
+* Flat-combining front end for ConcurrentAVLTree. insert and remove do not touch the tree themselves: a
+* thread publishes its request in its own slot of a publication list and waits, and whichever waiter
+* takes the combiner flag applies every pending request at once. The combiner sorts them by key, so one
+* hint walks the tree from key to key, and folds each key's requests into at most one change: of
+* several inserts of a key only the first can succeed, and an insert that a later remove in the same pass
+* undoes (or the reverse) never reaches the tree. Each request gets the result it would have had if the
+* pass had applied them one by one, in slot order. contains goes straight to the tree.
+*
+* With every update going through the one combiner the tree has a single writer, so a pass changes it
+* with no lock contention at all; what it costs is a hand-off per request. That pays where many threads
+* update few keys (a small or skewed key range), not where updates spread out. It has only been
+* measured on one core, where it loses, so nothing uses it unless asked to; see README.
+* The parameters are ConcurrentAVLTree's; Backoff also paces the threads waiting on the combiner. */
+template<typename T, typename Reclaimer = EpochReclamation, typename Lock = SpinLock, typename Ordering = LockedOrdering,
+         typename Stats = NoStats, typename Layout = PackedLayout, typename Allocator = PoolAllocation,
+         typename Compare = std::less<T>, typename Balancing = AVLBalancing, typename Removal = UnlinkRemoval,
+         typename Backoff = YieldBackoff>
+class FlatCombiningTree
+{
+    typedef ConcurrentAVLTree<T, Reclaimer, Lock, Ordering, Stats, Layout, Allocator, Compare, Balancing, Removal, Backoff> Tree;
+    typedef typename std::conditional<std::is_scalar<T>::value, T, const T&>::type Key;
+
+public:
+    FlatCombiningTree()
+    {
+        _requests.reserve(ThreadRegistry::max_threads);
+        _removals.reserve(ThreadRegistry::max_threads);
+    }
+
+    bool insert(Key data)
+    {
+        return publish(INSERT, data);
+    }
+
+    bool remove(Key data)
+    {
+        return publish(REMOVE, data);
+    }
+
+    bool contains(Key data) const
+    {
+        return _tree.contains(data);
+    }
+
+    /**
+    * @return how many insert and remove requests were folded into an earlier one for the same key in the
+    * same pass, and so cost the tree nothing. */
+    std::uint64_t eliminated() const
+    {
+        return _eliminated.load(std::memory_order_relaxed);
+    }
+
+    ContentionSnapshot stats() const
+    {
+        return _tree.stats();
+    }
+
+    std::uint64_t systemAllocations() const
+    {
+        return _tree.systemAllocations();
+    }
+
+private:
+    enum Operation
+    {
+        INSERT,
+        REMOVE
+    };
+
+    // written by its thread before pending is set and by the combiner before it is cleared
+    struct alignas(64) Slot
+    {
+        std::atomic<bool> pending{false};
+        Operation operation = INSERT;
+        bool result = false;
+        T data;
+    };
+
+    Tree _tree;
+    Compare _less;
+    Slot _slots[ThreadRegistry::max_threads];
+    std::atomic<bool> _combining{false};
+    std::atomic<std::uint64_t> _eliminated{0};
+
+    // the combiner's scratch space, only touched while holding _combining
+    std::vector<std::size_t> _requests;
+    std::vector<T> _removals;
+
+    bool publish(Operation operation, Key data)
+    {
+        auto &slot = _slots[ThreadRegistry::index()];
+        slot.operation = operation;
+        slot.data = data;
+        slot.pending.store(true, std::memory_order_release);
+
+        Backoff backoff;
+        while (slot.pending.load(std::memory_order_acquire))
+        {
+            if (!_combining.load(std::memory_order_relaxed) && !_combining.exchange(true, std::memory_order_acquire))
+            {
+                combine();
+                _combining.store(false, std::memory_order_release);
+            }
+            else backoff.wait();
+        }
+
+        return slot.result;
+    }
+
+    bool equal(Key a, Key b) const
+    {
+        return !_less(a, b) && !_less(b, a);
+    }
+
+    /**
+    * One combining pass over the requests pending when it scans the list; the caller's own is among them.
+    * Inserts are applied through a hint as the keys ascend, and removes afterwards as one removeBatch, once
+    * the hint has let go of its guard: a remove nested inside it would need a guard of its own, and
+    * HazardPointerReclamation only allows a few at once. No request is answered before the tree holds its
+    * effect. */
+    void combine()
+    {
+        _requests.clear();
+        _removals.clear();
+        for (std::size_t i = 0; i < ThreadRegistry::highWater(); ++i)
+            if (_slots[i].pending.load(std::memory_order_acquire)) _requests.push_back(i);
+
+        std::sort(_requests.begin(), _requests.end(), [this](std::size_t a, std::size_t b) {
+            if (_less(_slots[a].data, _slots[b].data)) return true;
+            return !_less(_slots[b].data, _slots[a].data) && a < b;
+        });
+
+        std::uint64_t eliminated = 0;
+        {
+            auto hint = _tree.hint();
+            for (std::size_t first = 0, last; first < _requests.size(); first = last)
+            {
+                auto &head = _slots[_requests[first]];
+                for (last = first + 1; last < _requests.size() && equal(head.data, _slots[_requests[last]].data); ++last);
+
+                // a lone insert learns its result from the tree itself; a lone remove goes the way below, so
+                // that no remove runs under the hint's guard
+                if (last - first == 1 && head.operation == INSERT)
+                {
+                    head.result = _tree.insert(hint, head.data);
+                    continue;
+                }
+
+                // nothing else changes the tree, so the key stays as find saw it while its requests play out
+                bool initially = _tree.find(hint, head.data);
+                bool present = initially;
+                for (auto i = first; i < last; ++i)
+                {
+                    auto &slot = _slots[_requests[i]];
+                    slot.result = (slot.operation == INSERT) != present;
+                    present = slot.operation == INSERT;
+                }
+
+                eliminated += last - first - 1;
+                if (present == initially) continue;
+                if (present) _tree.insert(hint, head.data);
+                else _removals.push_back(head.data);
+            }
+        }
+
+        if (!_removals.empty()) _tree.removeBatch(_removals.begin(), _removals.end());
+        _eliminated.store(_eliminated.load(std::memory_order_relaxed) + eliminated, std::memory_order_relaxed);
+
+        for (auto index : _requests)
+            _slots[index].pending.store(false, std::memory_order_release);
+    }
+};
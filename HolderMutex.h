@@ -1,4 +1,6 @@
+#pragma once
 
+#include <atomic>
 #include <thread>
 #include <mutex>
 
@@ -8,7 +10,7 @@ public:
     void lock()
     {
         std::recursive_mutex::lock();
-        m_holder = std::this_thread::get_id();
+        m_holder.store(std::this_thread::get_id(), std::memory_order_relaxed);
         m_num_locks++;
     }
 
@@ -18,7 +20,7 @@ public:
 
         if (ret)
         {
-            m_holder = std::this_thread::get_id();
+            m_holder.store(std::this_thread::get_id(), std::memory_order_relaxed);
             m_num_locks++;
         }
 
@@ -29,7 +31,7 @@ public:
     * Resets the holder id and calls unlock the specified number of times to the recursive_mutex. */
     void unlock()
     {
-        m_holder = std::thread::id();
+        m_holder.store(std::thread::id(), std::memory_order_relaxed);
 
         auto temp = m_num_locks;
         m_num_locks = 0;
@@ -44,10 +46,10 @@ public:
     * @return true iff the recursive_mutex is locked by the caller of this method. */
     bool owns_lock() const
     {
-        return m_holder == std::this_thread::get_id();
+        return m_holder.load(std::memory_order_relaxed) == std::this_thread::get_id();
     }
 
 private:
-    std::thread::id m_holder;
+    std::atomic<std::thread::id> m_holder; // read by non-holders in owns_lock()
     int m_num_locks = 0;
 };
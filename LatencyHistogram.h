@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+* HDR-style latency histogram: values below 2^sub_bucket_bits are counted exactly, and every power of two
+* above that is split into 2^sub_bucket_bits equal buckets, so a reported value is within 1 / 2^sub_bucket_bits
+* (about 3%) of the recorded one over the whole 64-bit range. Recording is a few shifts and one increment,
+* and is not thread-safe: each thread records into its own histogram and they are merged afterwards. */
+class LatencyHistogram
+{
+public:
+    static const int sub_bucket_bits = 5;
+    static const std::uint64_t sub_bucket_count = std::uint64_t(1) << sub_bucket_bits;
+
+    LatencyHistogram() :
+        m_counts(bucketIndex(UINT64_MAX) + 1, 0)
+    {
+    }
+
+    void record(std::uint64_t value)
+    {
+        m_counts[bucketIndex(value)]++;
+        m_total++;
+        if (value > m_max) m_max = value;
+    }
+
+    void merge(const LatencyHistogram &other)
+    {
+        for (std::size_t i = 0; i < m_counts.size(); ++i)
+            m_counts[i] += other.m_counts[i];
+        m_total += other.m_total;
+        if (other.m_max > m_max) m_max = other.m_max;
+    }
+
+    std::uint64_t count() const { return m_total; }
+    std::uint64_t max() const { return m_max; }
+
+    /**
+    * @return the highest value equivalent to the one at quantile q in [0, 1], or 0 when empty. */
+    std::uint64_t percentile(double q) const
+    {
+        if (m_total == 0) return 0;
+
+        auto rank = static_cast<std::uint64_t>(q * m_total);
+        if (rank < 1) rank = 1;
+        if (rank > m_total) rank = m_total;
+
+        std::uint64_t seen = 0;
+        for (std::size_t i = 0; i < m_counts.size(); ++i)
+        {
+            seen += m_counts[i];
+            if (seen >= rank)
+                return highestEquivalent(i) < m_max ? highestEquivalent(i) : m_max;
+        }
+
+        return m_max;
+    }
+
+private:
+    std::vector<std::uint64_t> m_counts;
+    std::uint64_t m_total = 0;
+    std::uint64_t m_max = 0;
+
+    static std::size_t bucketIndex(std::uint64_t value)
+    {
+        if (value < sub_bucket_count) return value;
+
+        int msb = 63 - __builtin_clzll(value);
+        int shift = msb - sub_bucket_bits;
+        return (msb - sub_bucket_bits + 1) * sub_bucket_count + ((value >> shift) & (sub_bucket_count - 1));
+    }
+
+    static std::uint64_t highestEquivalent(std::size_t index)
+    {
+        if (index < sub_bucket_count) return index;
+
+        int shift = static_cast<int>(index / sub_bucket_count) - 1;
+        auto lowest = (sub_bucket_count + index % sub_bucket_count) << shift;
+        return lowest + ((std::uint64_t(1) << shift) - 1);
+    }
+};
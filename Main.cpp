@@ -1,141 +1,295 @@
 
-#include <cstdlib>
-#include <thread>
-#include <cassert>
-#include <cmath>
 #include <iostream>
+#include <limits>
 #include <fstream>
-#include <random>
+#include <functional>
+#include <mutex>
+#include <queue>
 #include <chrono>
+#include <string>
+#include <type_traits>
 #include <vector>
 
+#include "Benchmark.h"
 #include "BST.h"
+#include "ConcurrentAVLMap.h"
 #include "ConcurrentBST.h"
+#include "FlatCombining.h"
 
-enum FNS
+/**
+* The deferred policy's settings: each run's tree gets the imbalance budget, and maintenance on a thread of its own
+* until the clock stops if asked. After the last run, the fixes still pending are applied at once, and how many
+* there were, how long that took and how deep the keys sit afterwards are noted. */
+struct DeferredHooks
 {
-    ADD,
-    REMOVE,
-    CONTAINS
+    std::size_t budget;
+    bool maintain;
+
+    template<typename Tree>
+    void prepare(Tree &tree) const
+    {
+        tree.setImbalanceBudget(budget);
+        if (maintain) tree.startMaintenance();
+    }
+
+    template<typename Tree>
+    void settle(Tree &tree) const
+    {
+        tree.stopMaintenance();
+    }
+
+    template<typename Tree>
+    void report(Tree &tree, BenchmarkNotes &notes) const
+    {
+        auto start_time = std::chrono::steady_clock::now();
+        notes.emplace_back("fixes_left", tree.maintain());
+        notes.emplace_back("maintain_seconds", std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count());
+
+        BenchmarkNotes shape;
+        noteShape(tree, shape, 0);
+        notes.emplace_back("depth_after_maintain", shape.front().second);
+    }
 };
 
-double getUnitRandom()
+/**
+* The tombstone policy's purge ratio, with 0 for never purging. After the last run, the tombstones left are
+* counted and purged at once, and how many there were and how long that took are noted. */
+struct TombstoneHooks : NoBenchmarkHooks
 {
-    static std::mt19937* generator = nullptr;
-    if (!generator)
-        generator = new std::mt19937(std::chrono::high_resolution_clock::now().time_since_epoch().count());
-    std::uniform_real_distribution<double> distribution(0.0, 1.0);
-    return distribution(*generator);
-}
+    double purge_ratio;
 
-int main(int argc, char **argv)
-{
-    int num_max_threads = 32;
-    const int num_iterations = 65536; // power of 2 (seems to stack overflow if this gets any higher)
-    const int num_runs = 10;
-    float insert_percent = 1.0f / 3.0f;
-    float remove_percent = 1.0f / 3.0f;
-    float contains_percent = 1.0f / 3.0f;
-    const int number_range = 100;
-
-    if (argc > 1)
+    explicit TombstoneHooks(double ratio) : purge_ratio(ratio) {}
+
+    template<typename Tree>
+    void prepare(Tree &tree) const
     {
-        // usage example: ./bst.exe 33 33 33
-        insert_percent = (std::atoi(argv[1]) / 100.0f);
-        remove_percent = (std::atoi(argv[2]) / 100.0f); // beware!
-        contains_percent = (std::atoi(argv[3]) / 100.0f);
-        assert(std::abs(1.f - (insert_percent + remove_percent + contains_percent)) <= 0.01);
+        tree.setPurgeRatio(purge_ratio > 0 ? purge_ratio : std::numeric_limits<double>::infinity());
     }
 
-    // precompute various queries to random as to not pollute timing results.
-    alignas(64) FNS precomputed_function_ratios[num_iterations]; // compiler aligns sequential memory to fill cache lines to avoid false sharing
-    alignas(64) int precomputed_randoms[num_iterations];
-    for (int i = 0; i < num_iterations; ++i)
+    template<typename Tree>
+    void report(Tree &tree, BenchmarkNotes &notes) const
     {
-        auto r = getUnitRandom();
-        if (r < insert_percent)
-            precomputed_function_ratios[i] = FNS::ADD;
-        else if (r > (insert_percent + remove_percent))
-            precomputed_function_ratios[i] = FNS::CONTAINS;
-        else precomputed_function_ratios[i] = FNS::REMOVE;
-
-        precomputed_randoms[i] = (int)(getUnitRandom() * number_range);
+        notes.emplace_back("tombstones_left", tree.tombstones());
+        auto start_time = std::chrono::steady_clock::now();
+        tree.purge();
+        notes.emplace_back("purge_seconds", std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count());
     }
+};
 
-    ////////////////// Run single threaded avl tests
-    float average_time = 0.f;
-    for (int r = 0; r < num_runs; ++r)
+// the concurrent tree with the named policy swapped in for its own, or as it is for "default"
+template<typename Ordering>
+BenchmarkResult runPolicyBenchmark(const std::string &label, const std::string &policy, const BenchmarkOptions &options,
+                                   KeyDistribution distribution, BenchmarkMode mode, int num_threads)
+{
+    if (policy == "hazard")
+        return runBenchmark<ConcurrentAVLTree<int, HazardPointerReclamation, SpinLock, Ordering>>(label, options, distribution, mode, num_threads);
+    if (policy == "no_reclamation")
+        return runBenchmark<ConcurrentAVLTree<int, NoReclamation, SpinLock, Ordering>>(label, options, distribution, mode, num_threads);
+    if (policy == "holder_mutex")
+        return runBenchmark<ConcurrentAVLTree<int, EpochReclamation, HolderMutex, Ordering>>(label, options, distribution, mode, num_threads);
+    if (policy == "cacheline")
+        return runBenchmark<ConcurrentAVLTree<int, EpochReclamation, SpinLock, Ordering, NoStats, CacheLineLayout>>(label, options, distribution, mode, num_threads);
+    if (policy == "split")
+        return runBenchmark<ConcurrentAVLTree<int, EpochReclamation, SpinLock, Ordering, NoStats, SplitLayout>>(label, options, distribution, mode, num_threads);
+    if (policy == "deferred")
+        return runBenchmark<ConcurrentAVLTree<int, EpochReclamation, SpinLock, Ordering, NoStats, PackedLayout, PoolAllocation,
+                                              std::less<int>, DeferredBalancing>>(label, options, distribution, mode, num_threads,
+                                                                                  DeferredHooks{std::size_t(options.budget), options.maintain});
+    if (policy == "spin_backoff")
+        return runBenchmark<ConcurrentAVLTree<int, EpochReclamation, SpinLock, Ordering, NoStats, PackedLayout, PoolAllocation,
+                                              std::less<int>, AVLBalancing, UnlinkRemoval, SpinBackoff>>(label, options, distribution, mode, num_threads);
+    if (policy == "exponential_backoff")
+        return runBenchmark<ConcurrentAVLTree<int, EpochReclamation, SpinLock, Ordering, NoStats, PackedLayout, PoolAllocation,
+                                              std::less<int>, AVLBalancing, UnlinkRemoval, ExponentialBackoff>>(label, options, distribution, mode, num_threads);
+    if (policy == "parking_backoff")
+        return runBenchmark<ConcurrentAVLTree<int, EpochReclamation, SpinLock, Ordering, NoStats, PackedLayout, PoolAllocation,
+                                              std::less<int>, AVLBalancing, UnlinkRemoval, ParkingBackoff>>(label, options, distribution, mode, num_threads);
+    if (policy == "tombstone")
     {
-        AVLTree<int> avl;
-        auto start_time = std::chrono::high_resolution_clock::now();
+        // tombstones need the locked ordering, so the lock-free tree is skipped
+        if constexpr (std::is_same<Ordering, LockedOrdering>::value)
+            return runBenchmark<ConcurrentAVLTree<int, EpochReclamation, SpinLock, Ordering, NoStats, PackedLayout, PoolAllocation,
+                                                  std::less<int>, AVLBalancing, TombstoneRemoval>>(label, options, distribution, mode, num_threads,
+                                                                                                   TombstoneHooks(options.purge_ratio));
+        BenchmarkResult skipped{distribution, mode, label, num_threads, 0, 0, {}, {}, {}, 0};
+        return skipped;
+    }
+    return runBenchmark<ConcurrentAVLTree<int, EpochReclamation, SpinLock, Ordering>>(label, options, distribution, mode, num_threads);
+}
 
-        for (int i = 0; i < num_iterations; ++i)
-        {
-            auto r = precomputed_randoms[i];
-            switch (precomputed_function_ratios[i])
-            {
-                case FNS::ADD:      avl.insert(r); break;
-                case FNS::REMOVE:   avl.remove(r); break;
-                case FNS::CONTAINS: avl.contains(r); break;
-            }
-        }
+/**
+* ConcurrentAVLMap behind the set operations the harness drives: every key maps to a counter, inserts add
+* absent keys, and an update increments a present key's counter in place, holding only its entry's lock. */
+class CounterMap
+{
+public:
+    bool insert(int key) { return _map.putIfAbsent(key, 0); }
+    bool remove(int key) { return _map.erase(key); }
+    bool contains(int key) const { return _map.contains(key); }
+    bool update(int key) { return _map.computeIfPresent(key, [](long &value) { ++value; }); }
+    std::uint64_t systemAllocations() const { return _map.systemAllocations(); }
+
+private:
+    ConcurrentAVLMap<int, long> _map;
+};
+
+// std::priority_queue behind one mutex, the baseline for the queue mode; it has no lookups, so it runs nothing else
+class LockedPriorityQueue
+{
+public:
+    bool insert(int key)
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+        _queue.push(key);
+        return true;
+    }
 
-        auto curr_time = std::chrono::high_resolution_clock::now();
-        auto delta_time = std::chrono::duration_cast<std::chrono::milliseconds>(curr_time - start_time).count();
-        average_time += delta_time;
+    bool popMin(int &result, std::size_t = 1)
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+        if (_queue.empty()) return false;
+        result = _queue.top();
+        _queue.pop();
+        return true;
     }
 
-    average_time /= num_runs;
-    std::cout << average_time << " ";
+private:
+    std::mutex _lock;
+    std::priority_queue<int, std::vector<int>, std::greater<int>> _queue;
+};
 
-    ////////////////// Run concurrent avl tests
-    for (int t = 2; t <= num_max_threads; t *= 2)
+int main(int argc, char **argv)
+{
+    if (argc > 1 && (std::string(argv[1]) == "--help" || std::string(argv[1]) == "-h"))
     {
-        average_time = 0.f;
+        std::cout << benchmarkUsage();
+        return 0;
+    }
 
-        for (int r = 0; r < num_runs; ++r)
-        {
-            std::vector<std::thread> threads(t);
-            ConcurrentAVLTree<int> c_avl;
+    BenchmarkOptions options;
+    try
+    {
+        // usage example: ./bst --mix 33,33,34 --range 65536 --threads 1,2,4,8 --csv results.csv
+        options = parseBenchmarkOptions(argc, argv);
+    }
+    catch (const std::invalid_argument &error)
+    {
+        std::cerr << error.what() << "\n" << benchmarkUsage();
+        return 1;
+    }
 
-            auto start_time = std::chrono::high_resolution_clock::now();
-            for (int i = 0; i < t; ++i)
+    std::vector<BenchmarkResult> results;
+    bool failed = false;
+    for (auto distribution : options.distributions)
+    {
+        for (auto mode : options.modes)
+        {
+            for (auto &tree : options.trees)
             {
-                threads.emplace_back(std::thread([](ConcurrentAVLTree<int> &c_avl, int stride, int *randoms, FNS *ratios) {
-
-                    // iterate for a specified stride, using precomputed random numbers to
-                    // determine which interface function to call: i.e. insert, remove, contains.
-                    for (int j = 0; j < stride; ++j)
+                // only the concurrent and lockfree trees take a policy; everything else runs once, as it is
+                bool takes_policy = tree == "concurrent" || tree == "lockfree";
+                for (std::size_t p = 0; p < (takes_policy ? options.policies.size() : 1); ++p)
+                {
+                    auto &policy = options.policies[p];
+                    auto name = takes_policy && policy != "default" ? tree + "/" + policy : tree;
+                    for (auto num_threads : options.thread_counts)
                     {
-                        switch (*ratios)
+                        BenchmarkResult result;
+                        try
+                        {
+                            if (tree == "sequential")
+                            {
+                                // the sequential tree is only meaningful single-threaded
+                                if (num_threads != 1) continue;
+                                result = runBenchmark<AVLTree<int>>(name, options, distribution, mode, num_threads);
+                            }
+                            else if (tree == "concurrent")
+                                result = runPolicyBenchmark<LockedOrdering>(name, policy, options, distribution, mode, num_threads);
+                            else if (tree == "lockfree")
+                                result = runPolicyBenchmark<LockFreeOrdering>(name, policy, options, distribution, mode, num_threads);
+                            else if (tree == "concurrent_stats")
+                                result = runBenchmark<ConcurrentAVLTree<int, EpochReclamation, SpinLock, LockedOrdering, ContentionStats>>(name, options, distribution, mode, num_threads);
+                            else if (tree == "lockfree_stats")
+                                result = runBenchmark<ConcurrentAVLTree<int, EpochReclamation, SpinLock, LockFreeOrdering, ContentionStats>>(name, options, distribution, mode, num_threads);
+                            else if (tree == "concurrent_heap")
+                                result = runBenchmark<ConcurrentAVLTree<int, EpochReclamation, SpinLock, LockedOrdering, NoStats, PackedLayout, HeapAllocation>>(name, options, distribution, mode, num_threads);
+                            else if (tree == "lockfree_heap")
+                                result = runBenchmark<ConcurrentAVLTree<int, EpochReclamation, SpinLock, LockFreeOrdering, NoStats, PackedLayout, HeapAllocation>>(name, options, distribution, mode, num_threads);
+                            else if (tree == "sequential_bst")
+                            {
+                                if (num_threads != 1) continue;
+                                result = runBenchmark<BST<int>>(name, options, distribution, mode, num_threads);
+                            }
+                            else if (tree == "concurrent_bst")
+                                result = runBenchmark<ConcurrentBST<int>>(name, options, distribution, mode, num_threads);
+                            else if (tree == "lockfree_bst")
+                                result = runBenchmark<ConcurrentBST<int, EpochReclamation, SpinLock, LockFreeOrdering>>(name, options, distribution, mode, num_threads);
+                            else if (tree == "concurrent_combining")
+                                result = runBenchmark<FlatCombiningTree<int>>(name, options, distribution, mode, num_threads);
+                            else if (tree == "lockfree_combining")
+                                result = runBenchmark<FlatCombiningTree<int, EpochReclamation, SpinLock, LockFreeOrdering>>(name, options, distribution, mode, num_threads);
+                            else if (tree == "map")
+                                result = runBenchmark<CounterMap>(name, options, distribution, mode, num_threads);
+                            else if (tree == "priority_queue")
+                                result = runBenchmark<LockedPriorityQueue>(name, options, distribution, mode, num_threads);
+                        }
+                        catch (const std::exception &error)
                         {
-                            case FNS::ADD:      c_avl.insert(*randoms); break;
-                            case FNS::REMOVE:   c_avl.remove(*randoms); break;
-                            case FNS::CONTAINS: c_avl.contains(*randoms); break;
+                            std::cout << key_distribution_names[distribution] << " " << benchmark_mode_names[mode] << " " << name
+                                      << " threads " << num_threads << " failed: " << error.what() << std::endl;
+                            failed = true;
+                            continue;
                         }
 
-                        ratios++; randoms++;
-                    }
-                }, std::ref(c_avl),
-                    std::floor(num_iterations / t),
-                    &precomputed_randoms[(num_iterations / t) * i],
-                    &precomputed_function_ratios[(num_iterations / t) * i]
-                    ));
-            }
+                        if (result.samples.empty())
+                        {
+                            std::cout << key_distribution_names[distribution] << " " << benchmark_mode_names[mode] << " " << name
+                                      << " skipped, the tree cannot run this configuration" << std::endl;
+                            break;
+                        }
 
-            for (auto &t : threads)
-            {
-                if (t.joinable())
-                    t.join();
-            }
+                        std::cout << key_distribution_names[distribution] << " " << benchmark_mode_names[mode] << " " << name
+                                  << " threads " << num_threads
+                                  << " ops_per_sec " << result.ops_per_sec << " stddev " << result.stddev << std::endl;
+
+                        for (int fn = 0; options.latency && fn < 3; ++fn)
+                        {
+                            auto &histogram = result.latency[fn];
+                            std::cout << "    " << fns_names[fn] << " count " << histogram.count();
+                            for (int q = 0; q < 3; ++q)
+                                std::cout << " " << latency_percentile_names[q] << "_ns " << histogram.percentile(latency_percentiles[q]);
+                            std::cout << " max_ns " << histogram.max() << std::endl;
+                        }
 
-            auto curr_time = std::chrono::high_resolution_clock::now();
-            auto delta_time = std::chrono::duration_cast<std::chrono::milliseconds>(curr_time - start_time).count();
+                        if (result.system_allocations >= 0)
+                            std::cout << "    system_allocations " << result.system_allocations << std::endl;
 
-            average_time += delta_time;
-        }
+                        if (!result.notes.empty())
+                        {
+                            std::cout << "   ";
+                            for (auto &note : result.notes)
+                                std::cout << " " << note.first << " " << note.second;
+                            std::cout << std::endl;
+                        }
 
-        average_time /= num_runs;
-        std::cout << average_time << " ";
+                        if (!result.contention.empty())
+                        {
+                            std::cout << "    contention";
+                            for (std::size_t e = 0; e < CONTENTION_EVENT_COUNT; ++e)
+                                std::cout << " " << contention_event_names[e] << " " << result.contention.counts[e];
+                            std::cout << std::endl;
+                        }
+                        results.push_back(result);
+                    }
+                }
+            }
+        }
     }
+
+    if (!options.csv_path.empty())
+        writeBenchmarkCsv(options.csv_path, options, results);
+    if (!options.json_path.empty())
+        writeBenchmarkJson(options.json_path, options, results);
+
+    return failed ? 1 : 0;
 }
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+#include "SpinLock.h"
+#include "ThreadRegistry.h"
+
+/**
+* The rebalancing DeferredBalancing leaves for later, as one log per thread of Fix entries naming the nodes
+* whose subtree heights an update changed without updating. A thread appends only to its own log;
+* maintenance takes whole logs from any thread, so the lock in front of each is one its owner almost always
+* finds free. */
+template<typename Fix>
+class PendingFixes
+{
+public:
+    PendingFixes() = default;
+    PendingFixes(const PendingFixes &) = delete;
+    PendingFixes& operator=(const PendingFixes &) = delete;
+
+    void record(const Fix &fix)
+    {
+        auto &record = m_records[ThreadRegistry::index()];
+        std::lock_guard<SpinLock> lock(record.lock);
+        record.fixes.push_back(fix);
+        record.count.store(record.fixes.size(), std::memory_order_relaxed);
+    }
+
+    /**
+    * @return how many fixes the calling thread's log holds. */
+    std::size_t pending() const
+    {
+        return m_records[ThreadRegistry::index()].count.load(std::memory_order_relaxed);
+    }
+
+    /**
+    * Replaces fixes with the log of the thread at index, leaving that log empty. */
+    void take(std::size_t index, std::vector<Fix> &fixes)
+    {
+        auto &record = m_records[index];
+        fixes.clear();
+        if (!record.count.load(std::memory_order_relaxed)) return;
+
+        std::lock_guard<SpinLock> lock(record.lock);
+        fixes.swap(record.fixes);
+        record.count.store(0, std::memory_order_relaxed);
+    }
+
+private:
+    struct alignas(64) Record
+    {
+        SpinLock lock;
+        std::atomic<std::size_t> count{0};
+        std::vector<Fix> fixes;
+    };
+
+    Record m_records[ThreadRegistry::max_threads];
+};
+
+/**
+* Stands in for PendingFixes under the balancing engines that never defer. */
+struct NoPendingFixes
+{
+};
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+/**
+* Hardware counters for the calling thread through perf_event_open (Linux only). Each event is opened on
+* its own, so a machine or VM that lacks one (or a kernel.perf_event_paranoid setting that forbids them
+* all) just leaves it unavailable; the counters are read as a delta between start() and stop(). */
+
+enum PerfEvent
+{
+    CYCLES,
+    INSTRUCTIONS,
+    L1D_READ_MISSES,
+    LLC_READ_MISSES,
+    PERF_EVENT_COUNT
+};
+
+const char* const perf_event_names[] = {
+    "cycles", "instructions", "l1d_read_misses", "llc_read_misses"
+};
+
+class PerfCounters
+{
+public:
+    PerfCounters()
+    {
+        for (int e = 0; e < PERF_EVENT_COUNT; ++e)
+        {
+            m_fds[e] = open(static_cast<PerfEvent>(e));
+            m_values[e] = 0;
+        }
+    }
+
+    ~PerfCounters()
+    {
+#ifdef __linux__
+        for (auto fd : m_fds)
+            if (fd >= 0) close(fd);
+#endif
+    }
+
+    PerfCounters(const PerfCounters &) = delete;
+    PerfCounters& operator=(const PerfCounters &) = delete;
+
+    bool available(PerfEvent event) const { return m_fds[event] >= 0; }
+
+    bool anyAvailable() const
+    {
+        for (auto fd : m_fds)
+            if (fd >= 0) return true;
+        return false;
+    }
+
+    void start()
+    {
+#ifdef __linux__
+        for (auto fd : m_fds)
+        {
+            if (fd < 0) continue;
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+    }
+
+    void stop()
+    {
+#ifdef __linux__
+        for (int e = 0; e < PERF_EVENT_COUNT; ++e)
+        {
+            if (m_fds[e] < 0) continue;
+            ioctl(m_fds[e], PERF_EVENT_IOC_DISABLE, 0);
+            if (read(m_fds[e], &m_values[e], sizeof(m_values[e])) != sizeof(m_values[e]))
+                m_values[e] = 0;
+        }
+#endif
+    }
+
+    /**
+    * @return the count between the last start() and stop(), or 0 if the event is unavailable. */
+    std::uint64_t value(PerfEvent event) const { return m_values[event]; }
+
+private:
+    int m_fds[PERF_EVENT_COUNT];
+    std::uint64_t m_values[PERF_EVENT_COUNT];
+
+    static int open(PerfEvent event)
+    {
+#ifdef __linux__
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+
+        const std::uint64_t read_miss = PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16;
+        switch (event)
+        {
+            case CYCLES:          attr.type = PERF_TYPE_HARDWARE; attr.config = PERF_COUNT_HW_CPU_CYCLES; break;
+            case INSTRUCTIONS:    attr.type = PERF_TYPE_HARDWARE; attr.config = PERF_COUNT_HW_INSTRUCTIONS; break;
+            case L1D_READ_MISSES: attr.type = PERF_TYPE_HW_CACHE; attr.config = PERF_COUNT_HW_CACHE_L1D | read_miss; break;
+            case LLC_READ_MISSES: attr.type = PERF_TYPE_HW_CACHE; attr.config = PERF_COUNT_HW_CACHE_LL | read_miss; break;
+            default: return -1;
+        }
+
+        return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+#else
+        (void)event;
+        return -1;
+#endif
+    }
+};
@@ -0,0 +1,363 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "ThreadRegistry.h"
+
+/**
+* Reclamation policies for nodes unlinked from a concurrent structure.
+*
+* Every policy exposes the same surface:
+*   Guard(policy)            pins the calling thread for the duration of an operation (guards nest).
+*   guard.protect(slot, ld)  returns ld(), published so it survives until the guard drops it.
+*   policy.retire(p, fn, c)  hands over an unlinked pointer; fn(c, p) frees it once no reader can hold it.
+*   needs_validation         true when protect alone is not enough and the caller must re-check that
+*                            the node it loaded from is still linked before trusting the result. */
+
+typedef void (*ReclaimFunction)(void *context, void *ptr);
+
+// ThreadSanitizer does not model std::atomic_thread_fence, so under it both sides below use read-modify-writes
+#if defined(__SANITIZE_THREAD__)
+#define RECLAMATION_RMW_FENCES 1
+#elif defined(__has_feature)
+#if __has_feature(thread_sanitizer)
+#define RECLAMATION_RMW_FENCES 1
+#endif
+#endif
+#if !defined(RECLAMATION_RMW_FENCES) && (defined(__x86_64__) || defined(__i386__))
+#define RECLAMATION_RMW_FENCES 1
+#endif
+
+/**
+* Stores value, then keeps every later load of the calling thread from being satisfied before the store
+* is visible. On x86 a locked exchange does both; a release store plus mfence is as correct but mfence
+* also holds back unrelated out-of-order work, which costs a pinned operation most of its overlap. */
+template<typename V>
+inline void storeFenced(std::atomic<V> &target, V value)
+{
+#if defined(RECLAMATION_RMW_FENCES)
+    target.exchange(value, std::memory_order_seq_cst);
+#else
+    target.store(value, std::memory_order_release);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+#endif
+}
+
+/**
+* The scanning side of storeFenced: keeps the calling thread's later loads from being satisfied before its
+* earlier stores are visible, through a seq_cst read-modify-write of counter where storeFenced uses an exchange. */
+template<typename V>
+inline void fenceThrough(std::atomic<V> &counter)
+{
+#if defined(RECLAMATION_RMW_FENCES)
+    counter.fetch_add(0, std::memory_order_seq_cst);
+#else
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+#endif
+}
+
+struct RetiredNode
+{
+    void *ptr;
+    ReclaimFunction reclaim;
+    void *context;
+
+    void free() const { reclaim(context, ptr); }
+};
+
+/**
+* Keeps every retired node until the policy is destroyed. This is the original leak-until-exit behavior
+* of the tree and serves as the baseline the other policies are measured against. */
+class NoReclamation
+{
+public:
+    static const bool needs_validation = false;
+
+    class Guard
+    {
+    public:
+        explicit Guard(NoReclamation &) {}
+
+        template<typename Load>
+        auto protect(std::size_t, Load load) -> decltype(load())
+        {
+            return load();
+        }
+    };
+
+    NoReclamation() = default;
+    NoReclamation(const NoReclamation &) = delete;
+    NoReclamation& operator=(const NoReclamation &) = delete;
+
+    ~NoReclamation()
+    {
+        for (auto &record : m_records)
+            for (auto &retired : record.retired)
+                retired.free();
+    }
+
+    void retire(void *ptr, ReclaimFunction reclaim, void *context)
+    {
+        m_records[ThreadRegistry::index()].retired.push_back(RetiredNode{ptr, reclaim, context});
+    }
+
+private:
+    struct alignas(64) Record
+    {
+        std::vector<RetiredNode> retired;
+    };
+
+    Record m_records[ThreadRegistry::max_threads];
+};
+
+/**
+* Epoch-based reclamation (Fraser). A pinned thread announces the global epoch it observed; the epoch
+* only advances once every pinned thread has caught up, and a node retired in epoch e is freed once the
+* global epoch reaches e + 2, at which point no thread can still be inside an operation that saw it. */
+class EpochReclamation
+{
+    static const std::uint64_t active_bit = 1;
+    static const std::size_t advance_interval = 64;
+
+    struct alignas(64) Record
+    {
+        std::atomic<std::uint64_t> announced{0};
+        unsigned depth = 0;
+        std::size_t retired_since_advance = 0;
+        std::uint64_t limbo_epoch[3] = {0, 0, 0};
+        std::vector<RetiredNode> limbo[3];
+    };
+
+public:
+    static const bool needs_validation = false;
+
+    class Guard
+    {
+    public:
+        explicit Guard(EpochReclamation &owner) :
+            m_record(owner.m_records[ThreadRegistry::index()])
+        {
+            if (m_record.depth++ == 0)
+            {
+                auto epoch = owner.m_epoch.load(std::memory_order_acquire);
+                // the announcement must be visible before this thread loads any link
+                storeFenced(m_record.announced, (epoch << 1) | active_bit);
+            }
+        }
+
+        ~Guard()
+        {
+            if (--m_record.depth == 0)
+                m_record.announced.store(0, std::memory_order_release);
+        }
+
+        Guard(const Guard &) = delete;
+        Guard& operator=(const Guard &) = delete;
+
+        template<typename Load>
+        auto protect(std::size_t, Load load) -> decltype(load())
+        {
+            return load();
+        }
+
+    private:
+        Record &m_record;
+    };
+
+    EpochReclamation() = default;
+    EpochReclamation(const EpochReclamation &) = delete;
+    EpochReclamation& operator=(const EpochReclamation &) = delete;
+
+    ~EpochReclamation()
+    {
+        for (auto &record : m_records)
+            for (auto &bag : record.limbo)
+                drain(bag);
+    }
+
+    /**
+    * Must be called while the caller holds a Guard, after ptr has been unlinked. */
+    void retire(void *ptr, ReclaimFunction reclaim, void *context)
+    {
+        auto &record = m_records[ThreadRegistry::index()];
+        auto epoch = m_epoch.load(std::memory_order_acquire);
+        auto slot = epoch % 3;
+
+        // the bag last filled three or more epochs ago is safe to empty before it is reused
+        if (record.limbo_epoch[slot] != epoch)
+        {
+            drain(record.limbo[slot]);
+            record.limbo_epoch[slot] = epoch;
+        }
+
+        record.limbo[slot].push_back(RetiredNode{ptr, reclaim, context});
+
+        if (++record.retired_since_advance >= advance_interval)
+        {
+            record.retired_since_advance = 0;
+            tryAdvance(epoch);
+        }
+    }
+
+private:
+    std::atomic<std::uint64_t> m_epoch{1};
+    Record m_records[ThreadRegistry::max_threads];
+
+    void tryAdvance(std::uint64_t epoch)
+    {
+        auto expected = (epoch << 1) | active_bit;
+        auto count = ThreadRegistry::highWater();
+
+        // pairs with storeFenced in Guard: unlinks made before this point are seen by anyone announcing later
+        fenceThrough(m_epoch);
+
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            auto announced = m_records[i].announced.load(std::memory_order_acquire);
+            if ((announced & active_bit) && announced != expected)
+                return;
+        }
+
+        m_epoch.compare_exchange_strong(epoch, epoch + 1);
+    }
+
+    static void drain(std::vector<RetiredNode> &bag)
+    {
+        for (auto &retired : bag)
+            retired.free();
+        bag.clear();
+    }
+};
+
+/**
+* Hazard pointers (Michael). Each guard owns a bank of slots in the calling thread's record; protect
+* publishes the loaded pointer and re-loads until the two agree. A retired node is freed by the retiring
+* thread once a scan of every published slot no longer finds it. Because a stale link inside an already
+* unlinked node still re-loads consistently, callers have to validate the node they loaded from. */
+class HazardPointerReclamation
+{
+public:
+    static const bool needs_validation = true;
+    static const std::size_t slots_per_guard = 16;
+    static const std::size_t max_guard_depth = 4;
+
+private:
+    struct alignas(64) Record
+    {
+        std::atomic<void*> hazards[max_guard_depth][slots_per_guard];
+        unsigned depth = 0;
+        std::vector<RetiredNode> retired;
+        std::vector<void*> scratch;
+
+        Record()
+        {
+            for (auto &bank : hazards)
+                for (auto &slot : bank)
+                    slot.store(nullptr, std::memory_order_relaxed);
+        }
+    };
+
+public:
+    class Guard
+    {
+    public:
+        explicit Guard(HazardPointerReclamation &owner) :
+            m_record(owner.m_records[ThreadRegistry::index()]),
+            m_bank(m_record.depth++)
+        {
+            assert(m_bank < max_guard_depth);
+        }
+
+        ~Guard()
+        {
+            for (auto &slot : m_record.hazards[m_bank])
+                slot.store(nullptr, std::memory_order_release);
+            m_record.depth--;
+        }
+
+        Guard(const Guard &) = delete;
+        Guard& operator=(const Guard &) = delete;
+
+        template<typename Load>
+        auto protect(std::size_t slot, Load load) -> decltype(load())
+        {
+            auto &hazard = m_record.hazards[m_bank][slot];
+            auto ptr = load();
+
+            while (true)
+            {
+                // also a release, so reads of what this slot protected before happen before a scan that sees it replaced
+                storeFenced(hazard, const_cast<void*>(static_cast<const void*>(ptr)));
+
+                auto again = load();
+                if (again == ptr) return ptr;
+                ptr = again;
+            }
+        }
+
+    private:
+        Record &m_record;
+        unsigned m_bank;
+    };
+
+    HazardPointerReclamation() = default;
+    HazardPointerReclamation(const HazardPointerReclamation &) = delete;
+    HazardPointerReclamation& operator=(const HazardPointerReclamation &) = delete;
+
+    ~HazardPointerReclamation()
+    {
+        for (auto &record : m_records)
+            for (auto &retired : record.retired)
+                retired.free();
+    }
+
+    void retire(void *ptr, ReclaimFunction reclaim, void *context)
+    {
+        auto &record = m_records[ThreadRegistry::index()];
+        record.retired.push_back(RetiredNode{ptr, reclaim, context});
+
+        // scanning once the list outgrows twice the published slots keeps the amortized cost per retire constant
+        if (record.retired.size() >= 2 * ThreadRegistry::highWater() * slots_per_guard * max_guard_depth)
+            scan(record);
+    }
+
+private:
+    Record m_records[ThreadRegistry::max_threads];
+    std::atomic<std::uint64_t> m_scan_fence{0};     // only ever read-modified-written, see fenceThrough
+
+    void scan(Record &record)
+    {
+        auto &hazards = record.scratch;
+        hazards.clear();
+
+        // pairs with storeFenced in protect: either the scan sees a slot or its owner's re-load sees the unlink
+        fenceThrough(m_scan_fence);
+
+        auto count = ThreadRegistry::highWater();
+        for (std::size_t i = 0; i < count; ++i)
+            for (auto &bank : m_records[i].hazards)
+                for (auto &slot : bank)
+                {
+                    auto ptr = slot.load(std::memory_order_acquire);
+                    if (ptr) hazards.push_back(ptr);
+                }
+
+        std::sort(hazards.begin(), hazards.end());
+
+        auto keep = record.retired.begin();
+        for (auto it = record.retired.begin(); it != record.retired.end(); ++it)
+        {
+            if (std::binary_search(hazards.begin(), hazards.end(), it->ptr))
+                *keep++ = *it;
+            else
+                it->free();
+        }
+
+        record.retired.erase(keep, record.retired.end());
+    }
+};
@@ -1,29 +1,59 @@
 #!/usr/bin/python3
 
+import csv
+import json
 import sys
-import math
 import matplotlib.pyplot as plt
 import numpy as np
 
-def plot(ir, rr, cr, data):
-    objects = ('1', '2', '4', '8', '16', '32')
-    y_pos = np.arange(len(objects))
-    barlist = plt.bar(y_pos, data[0], align='center', alpha=0.5)
-    barlist[0].set_color('r')
-    plt.ylabel("Execution Time (ms)")
+# reads the results written by `bst --csv PATH` or `bst --json PATH`
+def load(path):
+    with open(path) as f:
+        if path.endswith('.json'):
+            doc = json.load(f)
+            config = doc['config']
+            rows = doc['results']
+        else:
+            rows = list(csv.DictReader(f))
+            config = rows[0] if rows else {}
+
+    # one plot per key distribution, one series per tree and mode
+    plots = {}
+    for row in rows:
+        series = plots.setdefault(row.get('distribution', 'uniform'), {})
+        mode = row.get('mode', 'set')
+        label = row['tree'] if mode == 'set' else row['tree'] + ' ' + mode
+        series.setdefault(label, []).append((int(row['threads']), float(row['ops_per_sec']), float(row['stddev'])))
+    return config, plots
+
+def plot(config, distribution, series):
+    ir, rr, cr = str(config['insert']), str(config['remove']), str(config['contains'])
+    threads = sorted({t for points in series.values() for t, _, _ in points})
+    x_pos = np.arange(len(threads))
+    plt.figure()
+    width = 0.8 / len(series)
+
+    for i, (tree, points) in enumerate(series.items()):
+        by_threads = {t: (mean, stddev) for t, mean, stddev in points}
+        means = [by_threads.get(t, (0, 0))[0] for t in threads]
+        errors = [by_threads.get(t, (0, 0))[1] for t in threads]
+        plt.bar(x_pos + (i - (len(series) - 1) / 2) * width, means, width, yerr=errors, capsize=3, alpha=0.5, label=tree)
+
+    plt.ylabel("Throughput (ops/sec)")
     plt.xlabel("Threads")
-    plt.xticks(y_pos, objects)
-    plt.title(ir + "% insert, " + rr + "% remove, " + cr + "% contains")
-    plt.savefig(ir + "_" + rr + "_" + cr + '.png')
+    plt.xticks(x_pos, [str(t) for t in threads])
+    plt.legend()
+    plt.title(distribution + ", " + ir + "% insert, " + rr + "% remove, " + cr + "% contains, keys [0, " + str(config['range']) + ")")
+    prefix = '' if distribution == 'uniform' else distribution + '_'
+    plt.savefig(prefix + ir + "_" + rr + "_" + cr + '.png')
+    plt.close()
 
 def main(argv):
-    data = []
-    insertRatio = argv[1]
-    removeRatio = argv[2]
-    containsRatio = argv[3]
-    for line in sys.stdin:
-        data.append(list(map(float, line.split())))
-    plot(insertRatio, removeRatio, containsRatio, data)
+    if len(argv) != 2:
+        sys.exit("usage: ResultVisualizer.py results.csv|results.json")
+    config, plots = load(argv[1])
+    for distribution, series in plots.items():
+        plot(config, distribution, series)
 
 if __name__ == "__main__":
     main(sys.argv)
@@ -0,0 +1,196 @@
+#pragma once
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+* Files written by ConcurrentAVLTree::saveSnapshot (POSIX only): a 64-byte header, so the keys after it
+* are aligned for any key type the tree stores, followed by count keys in ascending order as raw bytes
+* of sizeof(T) each, in the writing machine's byte order. */
+struct SnapshotHeader
+{
+    static constexpr char expected_magic[8] = {'A', 'V', 'L', 'S', 'N', 'A', 'P', '1'};
+
+    char magic[8];
+    std::uint64_t key_size;
+    std::uint64_t count;
+    std::uint64_t reserved[5];
+};
+
+static_assert(sizeof(SnapshotHeader) == 64, "keys start on a 64-byte boundary");
+
+inline std::runtime_error snapshotError(const std::string &what, const std::string &path)
+{
+    return std::runtime_error("snapshot " + path + ": " + what + (errno ? std::string(": ") + std::strerror(errno) : ""));
+}
+
+/**
+* Streams keys into path + ".tmp" through a buffer, then writes the header, syncs and renames the file
+* over path, so a reader never sees a partial snapshot. A writer destroyed before finish() removes its
+* temporary file. */
+class SnapshotWriter
+{
+public:
+    static const std::size_t buffer_bytes = 1 << 20;
+
+    SnapshotWriter(const std::string &path, std::size_t key_size) :
+        m_path(path),
+        m_temp_path(path + ".tmp"),
+        m_key_size(key_size)
+    {
+        errno = 0;
+        m_fd = ::open(m_temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (m_fd < 0) throw snapshotError("cannot create", m_temp_path);
+
+        m_buffer.reserve(buffer_bytes);
+        m_buffer.resize(sizeof(SnapshotHeader)); // filled in by finish
+    }
+
+    ~SnapshotWriter()
+    {
+        if (m_fd < 0) return;
+        ::close(m_fd);
+        ::unlink(m_temp_path.c_str());
+    }
+
+    SnapshotWriter(const SnapshotWriter &) = delete;
+    SnapshotWriter& operator=(const SnapshotWriter &) = delete;
+
+    void append(const void *key)
+    {
+        if (m_buffer.size() + m_key_size > buffer_bytes) flush();
+        auto bytes = static_cast<const char*>(key);
+        m_buffer.insert(m_buffer.end(), bytes, bytes + m_key_size);
+    }
+
+    void finish(std::uint64_t count)
+    {
+        flush();
+
+        SnapshotHeader header = {};
+        std::memcpy(header.magic, SnapshotHeader::expected_magic, sizeof(header.magic));
+        header.key_size = m_key_size;
+        header.count = count;
+
+        errno = 0;
+        if (::pwrite(m_fd, &header, sizeof(header), 0) != ssize_t(sizeof(header))) throw snapshotError("cannot write header", m_temp_path);
+        if (::fsync(m_fd) != 0) throw snapshotError("cannot sync", m_temp_path);
+        if (::close(m_fd) != 0)
+        {
+            m_fd = -1;
+            ::unlink(m_temp_path.c_str());
+            throw snapshotError("cannot close", m_temp_path);
+        }
+        m_fd = -1;
+        if (::rename(m_temp_path.c_str(), m_path.c_str()) != 0)
+        {
+            ::unlink(m_temp_path.c_str());
+            throw snapshotError("cannot rename over", m_path);
+        }
+    }
+
+private:
+    std::string m_path;
+    std::string m_temp_path;
+    std::size_t m_key_size;
+    int m_fd;
+    std::vector<char> m_buffer;
+
+    void flush()
+    {
+        std::size_t written = 0;
+        while (written < m_buffer.size())
+        {
+            errno = 0;
+            auto n = ::write(m_fd, m_buffer.data() + written, m_buffer.size() - written);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) throw snapshotError("cannot write", m_temp_path);
+            written += std::size_t(n);
+        }
+        m_buffer.clear();
+    }
+};
+
+/**
+* A snapshot file mapped read-only, its header checked against the key size the reader expects.
+* keys() points into the mapping, which lasts as long as the object. */
+class SnapshotFile
+{
+public:
+    SnapshotFile(const std::string &path, std::size_t key_size)
+    {
+        errno = 0;
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) throw snapshotError("cannot open", path);
+
+        struct stat status;
+        if (::fstat(fd, &status) != 0)
+        {
+            auto error = errno;
+            ::close(fd);
+            errno = error;
+            throw snapshotError("cannot stat", path);
+        }
+        m_size = std::size_t(status.st_size);
+        if (m_size < sizeof(SnapshotHeader))
+        {
+            ::close(fd);
+            errno = 0;
+            throw snapshotError("truncated header", path);
+        }
+
+        m_data = ::mmap(NULL, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (m_data == MAP_FAILED) throw snapshotError("cannot map", path);
+        ::madvise(m_data, m_size, MADV_SEQUENTIAL);
+
+        errno = 0;
+        auto header = static_cast<const SnapshotHeader*>(m_data);
+        if (std::memcmp(header->magic, SnapshotHeader::expected_magic, sizeof(header->magic)) != 0)
+            fail("not a snapshot", path);
+        if (header->key_size != key_size)
+            fail("written with keys of " + std::to_string(header->key_size) + " bytes", path);
+        if (header->count > (m_size - sizeof(SnapshotHeader)) / key_size || sizeof(SnapshotHeader) + header->count * key_size != m_size)
+            fail("size does not match its key count", path);
+        m_count = header->count;
+    }
+
+    ~SnapshotFile()
+    {
+        ::munmap(m_data, m_size);
+    }
+
+    SnapshotFile(const SnapshotFile &) = delete;
+    SnapshotFile& operator=(const SnapshotFile &) = delete;
+
+    const void* keys() const
+    {
+        return static_cast<const char*>(m_data) + sizeof(SnapshotHeader);
+    }
+
+    std::size_t count() const
+    {
+        return m_count;
+    }
+
+private:
+    void *m_data;
+    std::size_t m_size;
+    std::size_t m_count;
+
+    [[noreturn]] void fail(const std::string &what, const std::string &path)
+    {
+        ::munmap(m_data, m_size);
+        throw snapshotError(what, path);
+    }
+};
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <type_traits>
+
+#include "Backoff.h"
+#include "ThreadRegistry.h"
+
+/**
+* Test-and-test-and-set spinlock that keeps its holder in one 32-bit word (ThreadRegistry index + 1, 0 when
+* free), so owns_lock() works without the thread::id and counter HolderMutex carries. Not recursive.
+* A waiter spins on the word for a while, then waits through a Backoff policy (see Backoff.h) between
+* looks; lock() yields, lock<Backoff>() lets the caller choose. */
+class SpinLock
+{
+public:
+    void lock()
+    {
+        lock<YieldBackoff>();
+    }
+
+    template<typename Backoff>
+    void lock()
+    {
+        auto self = holderId();
+        Backoff backoff;
+
+        while (true)
+        {
+            std::uint32_t expected = 0;
+            if (m_holder.compare_exchange_weak(expected, self, std::memory_order_acquire, std::memory_order_relaxed))
+                return;
+
+            // spin on a plain load so waiters share the line instead of bouncing it with failed CASes
+            for (int spins = 0; m_holder.load(std::memory_order_relaxed) != 0; ++spins)
+            {
+                if (spins < max_spins) cpuRelax();
+                else backoff.wait();
+            }
+        }
+    }
+
+    bool try_lock()
+    {
+        std::uint32_t expected = 0;
+        return m_holder.load(std::memory_order_relaxed) == 0 &&
+               m_holder.compare_exchange_strong(expected, holderId(), std::memory_order_acquire, std::memory_order_relaxed);
+    }
+
+    void unlock()
+    {
+        m_holder.store(0, std::memory_order_release);
+    }
+
+    /**
+    * @return true iff the lock is held by the caller of this method. */
+    bool owns_lock() const
+    {
+        return m_holder.load(std::memory_order_relaxed) == holderId();
+    }
+
+private:
+    static const int max_spins = 64;
+
+    std::atomic<std::uint32_t> m_holder{0};
+
+    static std::uint32_t holderId()
+    {
+        return static_cast<std::uint32_t>(ThreadRegistry::index()) + 1;
+    }
+};
+
+/**
+* Takes lock, pacing the wait with Backoff when lock is a SpinLock; other locks wait their own way. */
+template<typename Backoff, typename Lock>
+inline void lockWith(Lock &lock)
+{
+    if constexpr (std::is_same<Lock, SpinLock>::value) lock.template lock<Backoff>();
+    else lock.lock();
+}
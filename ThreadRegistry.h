@@ -0,0 +1,68 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <stdexcept>
+
+/**
+* Hands out small, dense indices to the threads touching a concurrent structure so per-thread
+* state can live in fixed arrays owned by that structure. An index is returned when its thread exits. */
+class ThreadRegistry
+{
+public:
+    static const std::size_t max_threads = 128;
+
+    /**
+    * @return the calling thread's index in [0, max_threads). */
+    static std::size_t index()
+    {
+        thread_local Slot slot;
+        return slot.index;
+    }
+
+    /**
+    * @return one past the highest index ever handed out, bounding scans over per-thread arrays. */
+    static std::size_t highWater()
+    {
+        return highWaterMark().load(std::memory_order_acquire);
+    }
+
+private:
+    struct Slot
+    {
+        std::size_t index;
+
+        Slot() : index(acquire()) {}
+        ~Slot() { used()[index].store(false, std::memory_order_release); }
+    };
+
+    static std::size_t acquire()
+    {
+        auto flags = used();
+        for (std::size_t i = 0; i < max_threads; ++i)
+        {
+            bool expected = false;
+            if (!flags[i].load(std::memory_order_relaxed) && flags[i].compare_exchange_strong(expected, true))
+            {
+                auto &high = highWaterMark();
+                auto current = high.load(std::memory_order_relaxed);
+                while (current < i + 1 && !high.compare_exchange_weak(current, i + 1));
+                return i;
+            }
+        }
+
+        throw std::runtime_error("ThreadRegistry: more than max_threads live threads");
+    }
+
+    static std::atomic<bool>* used()
+    {
+        static std::atomic<bool> flags[max_threads];
+        return flags;
+    }
+
+    static std::atomic<std::size_t>& highWaterMark()
+    {
+        static std::atomic<std::size_t> high(0);
+        return high;
+    }
+};
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "ThreadRegistry.h"
+
+/**
+* Removal policies. UnlinkRemoval (default) takes a removed node out of the list and the tree as part
+* of remove. TombstoneRemoval only marks it deleted, leaving a tombstone in both that an insert of the
+* same key revives and a purge takes out later, once tombstones make up more than the purge ratio of
+* the tree's nodes. It counts nodes and tombstones per thread to tell when that is. */
+struct UnlinkRemoval
+{
+    static const bool leaves_tombstones = false;
+};
+
+class TombstoneRemoval
+{
+public:
+    static const bool leaves_tombstones = true;
+
+    TombstoneRemoval() = default;
+    TombstoneRemoval(const TombstoneRemoval &) = delete;
+    TombstoneRemoval& operator=(const TombstoneRemoval &) = delete;
+
+    // only the owning thread writes its record, so a plain load and store is enough
+    void addNodes(std::int64_t n)
+    {
+        auto &count = m_records[ThreadRegistry::index()].nodes;
+        count.store(count.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    void addTombstones(std::int64_t n)
+    {
+        auto &record = m_records[ThreadRegistry::index()];
+        record.tombstones.store(record.tombstones.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+        if (n > 0) record.since_check += std::uint32_t(n);
+    }
+
+    /**
+    * @return the number of nodes, tombstones included, and of tombstones in the tree, each summed over
+    * the threads without stopping them. */
+    std::int64_t nodes() const
+    {
+        std::int64_t total = 0;
+        for (std::size_t i = 0; i < ThreadRegistry::highWater(); ++i)
+            total += m_records[i].nodes.load(std::memory_order_relaxed);
+        return total;
+    }
+
+    std::int64_t tombstones() const
+    {
+        std::int64_t total = 0;
+        for (std::size_t i = 0; i < ThreadRegistry::highWater(); ++i)
+            total += m_records[i].tombstones.load(std::memory_order_relaxed);
+        return total;
+    }
+
+    void setPurgeRatio(double ratio)
+    {
+        m_purge_ratio.store(ratio, std::memory_order_relaxed);
+    }
+
+    /**
+    * @return true when the calling thread has made check_interval tombstones since it last asked and
+    * the tree is past the purge ratio. */
+    bool purgeDue()
+    {
+        auto &record = m_records[ThreadRegistry::index()];
+        if (record.since_check < check_interval) return false;
+
+        record.since_check = 0;
+        auto dead = tombstones();
+        return dead > 0 && double(dead) > m_purge_ratio.load(std::memory_order_relaxed) * double(nodes());
+    }
+
+    // one purge at a time; the others skip theirs
+    bool tryStartPurge()
+    {
+        return !m_purging.exchange(true, std::memory_order_acquire);
+    }
+
+    void finishPurge()
+    {
+        m_purging.store(false, std::memory_order_release);
+    }
+
+private:
+    static const std::uint32_t check_interval = 256;
+
+    struct alignas(64) Record
+    {
+        std::atomic<std::int64_t> nodes{0};
+        std::atomic<std::int64_t> tombstones{0};
+        std::uint32_t since_check = 0;
+    };
+
+    Record m_records[ThreadRegistry::max_threads];
+    std::atomic<double> m_purge_ratio{0.25};
+    std::atomic<bool> m_purging{false};
+};
@@ -0,0 +1,98 @@
+#include "ConcurrentBST.h"
+#include "Test.h"
+
+/**
+* insertBatch and removeBatch: one thread sends batches sorted, unsorted and with repeated keys, and the
+* counts they return and the keys left must match std::set; then threads send batches of their own keys at
+* once, as in checkOwnedKeys. After each part checkStructure must hold, under DeferredBalancing once
+* maintain() has run. */
+template<bool deferred, typename Tree>
+void settle(Tree &tree)
+{
+    if constexpr (deferred) tree.maintain();
+    CHECK(tree.checkStructure());
+}
+
+template<typename Tree, bool deferred = false>
+void checkBatches()
+{
+    Tree tree;
+    std::set<int> model;
+    std::mt19937 rng(1);
+    for (int i = 0; i < 3000; ++i)
+    {
+        std::vector<int> keys(rng() % 40);
+        int base = rng() % 2000;
+        for (auto &k : keys) k = base + rng() % 100;
+        switch (rng() % 3)
+        {
+        case 0: std::sort(keys.begin(), keys.end()); keys.erase(std::unique(keys.begin(), keys.end()), keys.end()); break;
+        case 1: std::sort(keys.begin(), keys.end()); break;  // repeated keys next to each other
+        default: break;                                     // unsorted, repeats anywhere
+        }
+
+        std::size_t expected = 0;
+        if (rng() % 3)
+        {
+            for (int k : keys) expected += model.insert(k).second;
+            CHECK(tree.insertBatch(keys.begin(), keys.end()) == expected);
+        }
+        else
+        {
+            for (int k : keys) expected += model.erase(k);
+            CHECK(tree.removeBatch(keys.begin(), keys.end()) == expected);
+        }
+
+        if (i % 100 == 0)
+        {
+            std::vector<int> walked;
+            for (auto &k : tree) walked.push_back(k);
+            CHECK(std::equal(walked.begin(), walked.end(), model.begin(), model.end()));
+            settle<deferred>(tree);
+        }
+    }
+
+    const int threads = 8, slots = 256;
+    Tree owned;
+    std::vector<std::vector<char>> models(threads, std::vector<char>(slots, 0));
+    runThreads(threads, [&](int t) {
+        auto &mine = models[t];
+        std::mt19937 rng(2 + t);
+        for (int i = 0; i < 2000; ++i)
+        {
+            std::vector<int> keys(1 + rng() % 16);
+            for (auto &k : keys) k = int(rng() % slots) * threads + t;
+            if (rng() & 1) std::sort(keys.begin(), keys.end());
+
+            bool insert = rng() & 1;
+            std::size_t expected = 0;
+            for (int k : keys)
+            {
+                auto &present = mine[k / threads];
+                expected += insert != bool(present);
+                present = insert;
+            }
+            if (insert) CHECK(owned.insertBatch(keys.begin(), keys.end()) == expected);
+            else CHECK(owned.removeBatch(keys.begin(), keys.end()) == expected);
+        }
+    });
+
+    std::vector<int> expected, walked;
+    for (int k = 0; k < slots * threads; ++k)
+        if (models[k % threads][k / threads]) expected.push_back(k);
+    for (auto &k : owned) walked.push_back(k);
+    CHECK(walked == expected);
+    settle<deferred>(owned);
+}
+
+int main()
+{
+    checkBatches<ConcurrentAVLTree<int>>();
+    checkBatches<ConcurrentAVLTree<int, HazardPointerReclamation, SpinLock, LockFreeOrdering>>();
+    checkBatches<ConcurrentBST<int>>();
+    checkBatches<ConcurrentAVLTree<int, EpochReclamation, SpinLock, LockedOrdering, NoStats, PackedLayout, PoolAllocation,
+                                   std::less<int>, DeferredBalancing>, true>();
+    checkBatches<ConcurrentAVLTree<int, EpochReclamation, SpinLock, LockedOrdering, NoStats, PackedLayout, PoolAllocation,
+                                   std::less<int>, AVLBalancing, TombstoneRemoval>>();
+    return report("BatchTest");
+}
@@ -0,0 +1,95 @@
+#include <stdexcept>
+
+#include "ConcurrentBST.h"
+#include "Test.h"
+
+/**
+* buildFromSorted: trees of many sizes built on one thread and on several must hold exactly the keys, be
+* as shallow as a perfectly balanced tree and pass checkStructure. Input that is unsorted, repeats a key or
+* goes to a tree that is not empty must throw std::invalid_argument and leave the tree as it was. A built
+* tree must then take updates like any other: one thread against std::set, then threads on keys of their
+* own, as in checkOwnedKeys. */
+template<typename Tree>
+bool throwsInvalid(Tree &tree, const std::vector<int> &keys)
+{
+    try { tree.buildFromSorted(keys.begin(), keys.end()); }
+    catch (const std::invalid_argument &) { return true; }
+    return false;
+}
+
+template<typename Tree>
+void checkBuild()
+{
+    for (int n : {0, 1, 2, 3, 7, 8, 100, 1023, 1024, 20000})
+    {
+        std::vector<int> keys(n);
+        for (int i = 0; i < n; ++i) keys[i] = 3 * i + 1;
+        int levels = 0;
+        while ((1 << levels) <= n) ++levels;
+
+        for (unsigned threads : {1u, 8u})
+        {
+            Tree tree;
+            tree.buildFromSorted(keys.begin(), keys.end(), threads);
+            std::vector<int> walked;
+            for (auto &k : tree) walked.push_back(k);
+            CHECK(walked == keys);
+
+            std::size_t deepest = 0;
+            for (int k : keys) deepest = std::max(deepest, tree.depth(k));
+            CHECK(deepest == std::size_t(levels));
+            CHECK(tree.checkStructure());
+            CHECK(tree.contains(keys.empty() ? 1 : keys.back()) == !keys.empty());
+            CHECK(!tree.contains(0));
+        }
+
+        Tree constructed(keys.begin(), keys.end(), 4);
+        std::vector<int> walked;
+        for (auto &k : constructed) walked.push_back(k);
+        CHECK(walked == keys);
+    }
+
+    Tree rejected;
+    CHECK(throwsInvalid(rejected, {1, 3, 2}));
+    CHECK(throwsInvalid(rejected, {1, 2, 2, 3}));
+    CHECK(!rejected.begin().valid());
+    rejected.insert(5);
+    CHECK(throwsInvalid(rejected, {1, 2}));
+    CHECK(!rejected.contains(1) && rejected.contains(5));
+
+    std::vector<int> keys;
+    for (int k = 0; k < 4000; k += 2) keys.push_back(k);
+    Tree tree(keys.begin(), keys.end(), 8);
+    std::set<int> model(keys.begin(), keys.end());
+    std::mt19937 rng(1);
+    for (int i = 0; i < 30000; ++i)
+    {
+        int key = rng() % 4200;
+        switch (rng() % 3)
+        {
+        case 0: CHECK(tree.insert(key) == model.insert(key).second); break;
+        case 1: CHECK(tree.remove(key) == (model.erase(key) == 1)); break;
+        default: CHECK(tree.contains(key) == (model.count(key) == 1));
+        }
+    }
+    std::vector<int> walked;
+    for (auto &k : tree) walked.push_back(k);
+    CHECK(std::equal(walked.begin(), walked.end(), model.begin(), model.end()));
+    CHECK(tree.checkStructure());
+
+    const int threads = 8, slots = 256;
+    keys.clear();
+    for (int k = 0; k < threads * slots; k += 3) keys.push_back(k);
+    Tree owned(keys.begin(), keys.end(), 8);
+    checkOwnedKeys(owned, threads, slots, 10000, 2);
+    CHECK(owned.checkStructure());
+}
+
+int main()
+{
+    checkBuild<ConcurrentAVLTree<int>>();
+    checkBuild<ConcurrentAVLTree<int, HazardPointerReclamation, SpinLock, LockFreeOrdering>>();
+    checkBuild<ConcurrentAVLTree<int, EpochReclamation, SpinLock, LockedOrdering, NoStats, PackedLayout,
+                                 PoolAllocation, std::less<int>, AVLBalancing, TombstoneRemoval>>();
+    return report("BuildTest");
+}
@@ -0,0 +1,79 @@
+#include <map>
+
+#include "ConcurrentAVLMap.h"
+#include "Test.h"
+
+/**
+* ConcurrentAVLMap over the tree's policies: each operation checked against std::map on one thread, then
+* threads putting, erasing and reading keys of their own (k * threads + t), so each knows exactly what
+* get must return, and finally increments of shared counters, none of which may be lost. */
+template<typename Map>
+void checkMap()
+{
+    Map sequential;
+    std::map<int, int> model;
+    std::mt19937 rng(1);
+    for (int i = 0; i < 50000; ++i)
+    {
+        int key = rng() % 100, value = rng() % 1000, found = -1;
+        bool present = model.count(key) == 1;
+        switch (rng() % 5)
+        {
+        case 0: CHECK(sequential.put(key, value) == !present); model[key] = value; break;
+        case 1: CHECK(sequential.putIfAbsent(key, value) == model.emplace(key, value).second); break;
+        case 2: CHECK(sequential.erase(key) == (model.erase(key) == 1)); break;
+        case 3:
+            CHECK(sequential.computeIfPresent(key, [](int &v) { ++v; }) == present);
+            if (present) ++model[key];
+            break;
+        default: CHECK(sequential.get(key, found) == present && (!present || found == model[key]));
+        }
+    }
+
+    Map owned;
+    const int threads = 8, slots = 32;
+    runThreads(threads, [&](int t) {
+        std::mt19937 rng(2 + t);
+        std::vector<int> values(slots, -1);
+        for (int i = 0; i < 30000; ++i)
+        {
+            int slot = rng() % slots, key = slot * threads + t, value = i, found = -1;
+            switch (rng() % 3)
+            {
+            case 0: CHECK(owned.put(key, value) == (values[slot] < 0)); values[slot] = value; break;
+            case 1: CHECK(owned.erase(key) == (values[slot] >= 0)); values[slot] = -1; break;
+            default: CHECK(owned.get(key, found) == (values[slot] >= 0) && found == values[slot]);
+            }
+        }
+    });
+
+    Map counters;
+    runThreads(threads, [&](int t) {
+        for (int i = 0; i < 20000; ++i)
+            if (!counters.computeIfPresent(i % 16, [](int &v) { ++v; })) counters.putIfAbsent(i % 16, 0);
+    });
+    long total = 0;
+    for (int k = 0; k < 16; ++k)
+    {
+        int value = 0;
+        CHECK(counters.get(k, value));
+        total += value;
+    }
+    // each key's first computeIfPresent fails at least once before somebody puts the counter in
+    CHECK(total <= threads * 20000 - 16 && total >= threads * 20000 - 16 * threads);
+}
+
+template<typename Reclaimer, typename Ordering, typename Balancing, typename Removal, typename Backoff = YieldBackoff>
+using Map = ConcurrentAVLMap<int, int, Reclaimer, SpinLock, Ordering, NoStats, PackedLayout, PoolAllocation, std::less<int>,
+                             Balancing, Removal, Backoff>;
+
+int main()
+{
+    checkMap<Map<EpochReclamation, LockedOrdering, AVLBalancing, UnlinkRemoval>>();
+    checkMap<Map<HazardPointerReclamation, LockedOrdering, AVLBalancing, UnlinkRemoval, ParkingBackoff>>();
+    checkMap<Map<EpochReclamation, LockFreeOrdering, AVLBalancing, UnlinkRemoval>>();
+    checkMap<Map<EpochReclamation, LockedOrdering, DeferredBalancing, UnlinkRemoval>>();
+    checkMap<Map<EpochReclamation, LockedOrdering, AVLBalancing, TombstoneRemoval>>();
+    checkMap<Map<EpochReclamation, LockedOrdering, NoBalancing, TombstoneRemoval, ExponentialBackoff>>();
+    return report("ConcurrentAVLMapTest");
+}
@@ -0,0 +1,35 @@
+#include "ConcurrentBST.h"
+#include "Test.h"
+
+/**
+* ConcurrentBST, the unbalanced tree: against std::set on one thread, then threads on keys of their own,
+* under both orderings and both reclaimers, with checkStructure after each. Ascending inserts must leave
+* it a path, which it stays correct on. */
+template<typename Tree>
+void checkBST()
+{
+    checkAgainstSet<Tree>(30000, 500, 1);
+
+    Tree tree;
+    checkOwnedKeys(tree, 8, 128, 10000, 2);
+    CHECK(tree.checkStructure());
+
+    Tree path;
+    for (int k = 0; k < 2000; ++k) path.insert(k);
+    CHECK(path.depth(1999) == 2000);
+    CHECK(path.checkStructure());
+    for (int k = 0; k < 2000; k += 2) path.remove(k);
+    std::vector<int> walked;
+    for (auto &k : path) walked.push_back(k);
+    CHECK(walked.size() == 1000 && walked.front() == 1 && walked.back() == 1999);
+    CHECK(path.checkStructure());
+}
+
+int main()
+{
+    checkBST<ConcurrentBST<int>>();
+    checkBST<ConcurrentBST<int, HazardPointerReclamation>>();
+    checkBST<ConcurrentBST<int, EpochReclamation, SpinLock, LockFreeOrdering>>();
+    checkBST<ConcurrentBST<int, HazardPointerReclamation, SpinLock, LockFreeOrdering>>();
+    return report("ConcurrentBSTTest");
+}
@@ -0,0 +1,67 @@
+#include <memory>
+
+#include "ConcurrentBST.h"
+#include "Test.h"
+
+/**
+* containsMany: one thread looks up batches of every length up to twice the number of lanes and a
+* few longer, with repeated and absent keys and keys past both ends, against std::set. Then threads look
+* up batches mixing their own keys, whose answers they know, with keys other threads are changing. */
+template<typename Tree>
+void checkContainsMany()
+{
+    Tree tree;
+    std::set<int> model;
+    std::mt19937 rng(1);
+    for (int i = 0; i < 20000; ++i)
+    {
+        int key = rng() % 3000;
+        if (rng() % 3) CHECK(tree.insert(key) == model.insert(key).second);
+        else CHECK(tree.remove(key) == (model.erase(key) == 1));
+
+        std::size_t n = i % 10 ? i % 33 : 100 + rng() % 200;
+        std::vector<int> keys(n);
+        for (auto &k : keys) k = int(rng() % 3100) - 50;
+        std::unique_ptr<bool[]> results(new bool[n + 1]);
+        results[n] = true;  // must stay untouched
+        tree.containsMany(keys.data(), n, results.get());
+        for (std::size_t j = 0; j < n; ++j) CHECK(results[j] == (model.count(keys[j]) == 1));
+        CHECK(results[n]);
+    }
+
+    const int threads = 8, slots = 256;
+    Tree owned;
+    std::vector<std::vector<char>> models(threads, std::vector<char>(slots, 0));
+    runThreads(threads, [&](int t) {
+        auto &mine = models[t];
+        std::mt19937 rng(2 + t);
+        for (int i = 0; i < 10000; ++i)
+        {
+            int slot = rng() % slots;
+            bool insert = rng() & 1;
+            if (insert) owned.insert(slot * threads + t);
+            else owned.remove(slot * threads + t);
+            mine[slot] = insert;
+
+            // the even positions are this thread's keys, the odd ones anybody's
+            int keys[12];
+            bool results[12];
+            for (int j = 0; j < 12; ++j)
+                keys[j] = j % 2 ? int(rng() % (slots * threads)) : int(rng() % slots) * threads + t;
+            owned.containsMany(keys, 12, results);
+            for (int j = 0; j < 12; j += 2) CHECK(results[j] == bool(mine[keys[j] / threads]));
+        }
+    });
+}
+
+int main()
+{
+    checkContainsMany<ConcurrentAVLTree<int>>();
+    checkContainsMany<ConcurrentAVLTree<int, HazardPointerReclamation>>();
+    checkContainsMany<ConcurrentAVLTree<int, EpochReclamation, SpinLock, LockFreeOrdering>>();
+    checkContainsMany<ConcurrentAVLTree<int, HazardPointerReclamation, SpinLock, LockFreeOrdering>>();
+    checkContainsMany<ConcurrentBST<int>>();
+    checkContainsMany<ConcurrentAVLTree<int, EpochReclamation, SpinLock, LockedOrdering, NoStats, PackedLayout,
+                                        PoolAllocation, std::less<int>, AVLBalancing, TombstoneRemoval>>();
+    return report("ContainsManyTest");
+}
@@ -0,0 +1,62 @@
+#include <cmath>
+
+#include "ConcurrentBST.h"
+#include "Test.h"
+
+/**
+* DeferredBalancing: updates leave their rebalancing to later, and fixes run while the nodes they fix keep
+* changing. Whatever order that happens in, the keys must come out right, and once maintain() has run
+* with nothing else in flight the tree must be as balanced as an AVL tree. */
+template<typename Tree>
+void checkBalanced(Tree &tree)
+{
+    tree.maintain();
+    std::size_t keys = 0, deepest = 0;
+    for (auto &k : tree)
+    {
+        ++keys;
+        deepest = std::max(deepest, tree.depth(k));
+    }
+    CHECK(deepest <= 1.45 * std::log2(keys + 2));
+}
+
+template<typename Tree>
+void checkDeferred(std::size_t budget, bool background)
+{
+    // the worst input for a tree that does not rebalance
+    Tree ascending;
+    ascending.setImbalanceBudget(budget);
+    for (int k = 0; k < 4096; ++k) ascending.insert(k);
+    checkBalanced(ascending);
+
+    Tree tree;
+    tree.setImbalanceBudget(budget);
+    if (background) tree.startMaintenance(std::chrono::microseconds(50));
+    checkOwnedKeys(tree, 8, 256, 50000, budget);
+    tree.stopMaintenance();
+    checkBalanced(tree);
+}
+
+typedef ConcurrentAVLTree<int, EpochReclamation, SpinLock, LockedOrdering, NoStats, PackedLayout, PoolAllocation,
+                          std::less<int>, DeferredBalancing> Deferred;
+
+// parking waits stretch the windows in which a fix finds its node changed under it
+typedef ConcurrentAVLTree<int, HazardPointerReclamation, SpinLock, LockedOrdering, NoStats, PackedLayout,
+                          PoolAllocation, std::less<int>, DeferredBalancing, UnlinkRemoval, ParkingBackoff> DeferredParking;
+
+typedef ConcurrentAVLTree<int, EpochReclamation, SpinLock, LockFreeOrdering, NoStats, PackedLayout, PoolAllocation,
+                          std::less<int>, DeferredBalancing> DeferredLockFree;
+
+int main()
+{
+    checkAgainstSet<Deferred>(50000, 200, 1);
+    checkAgainstSet<DeferredLockFree>(50000, 200, 1);
+
+    checkDeferred<Deferred>(1, false);
+    checkDeferred<Deferred>(64, true);
+    checkDeferred<Deferred>(4096, true);
+    checkDeferred<DeferredParking>(1, false);
+    checkDeferred<DeferredParking>(64, true);
+    checkDeferred<DeferredLockFree>(64, true);
+    return report("DeferredBalancingTest");
+}
@@ -0,0 +1,50 @@
+#include "FlatCombining.h"
+#include "Test.h"
+
+/**
+* FlatCombiningTree: threads insert and remove keys of their own, checked against a model as in
+* checkOwnedKeys, mixed with requests for a few keys they all share, so combining passes carry lone
+* requests and groups for one key alike. On every shared key the successful inserts and removes must
+* alternate, so they may differ by at most the one key left in at the end. */
+template<typename Tree>
+void checkCombining(int threads)
+{
+    const int slots = 32, shared = 4;
+    Tree tree;
+    std::vector<std::atomic<long>> net(shared);
+    for (auto &count : net) count.store(0);
+
+    runThreads(threads, [&](int t) {
+        std::mt19937 rng(1 + t);
+        std::vector<char> model(slots, 0);
+        for (int i = 0; i < 20000; ++i)
+        {
+            bool insert = rng() & 1;
+            if (rng() % 4 == 0)
+            {
+                int key = rng() % shared;
+                if (insert ? tree.insert(key) : tree.remove(key)) net[key] += insert ? 1 : -1;
+                continue;
+            }
+
+            int slot = rng() % slots, key = shared + slot * threads + t;
+            if (insert) CHECK(tree.insert(key) != bool(model[slot]));
+            else CHECK(tree.remove(key) == bool(model[slot]));
+            model[slot] = insert;
+            CHECK(tree.contains(key) == insert);
+        }
+    });
+
+    for (int key = 0; key < shared; ++key)
+        CHECK(net[key].load() == (tree.contains(key) ? 1 : 0));
+}
+
+int main()
+{
+    checkCombining<FlatCombiningTree<int>>(8);
+    checkCombining<FlatCombiningTree<int, HazardPointerReclamation>>(8);
+    checkCombining<FlatCombiningTree<int, EpochReclamation, SpinLock, LockFreeOrdering>>(8);
+    checkCombining<FlatCombiningTree<int, HazardPointerReclamation, SpinLock, LockedOrdering, NoStats, PackedLayout,
+                                     PoolAllocation, std::less<int>, AVLBalancing, TombstoneRemoval>>(8);
+    return report("FlatCombiningTest");
+}
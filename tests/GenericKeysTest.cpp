@@ -0,0 +1,97 @@
+#include <functional>
+#include <string>
+
+#include "ConcurrentBST.h"
+#include "Test.h"
+
+/**
+* Keys other than ints in ascending order: std::string keys, long enough to live on the heap so that a node
+* freed too early shows under ASAN, and ints under std::greater. One thread checks insert, remove, contains,
+* containsMany, the nearest-key queries and the walk against a std::set ordered the same way; then threads
+* update keys of their own, as in checkOwnedKeys, and a walk must come out in the comparator's order with
+* exactly the keys the owners left in. */
+template<typename Tree, typename Compare, typename MakeKey>
+void checkKeys(MakeKey makeKey)
+{
+    typedef typename std::decay<decltype(makeKey(0))>::type Key;
+
+    Tree tree;
+    std::set<Key, Compare> model;
+    std::mt19937 rng(1);
+    for (int i = 0; i < 30000; ++i)
+    {
+        auto key = makeKey(rng() % 300);
+        switch (rng() % 4)
+        {
+        case 0: CHECK(tree.insert(key) == model.insert(key).second); break;
+        case 1: CHECK(tree.remove(key) == (model.erase(key) == 1)); break;
+        case 2: CHECK(tree.contains(key) == (model.count(key) == 1)); break;
+        default:
+        {
+            Key keys[3] = {key, makeKey(rng() % 300), makeKey(rng() % 300)};
+            bool results[3];
+            tree.containsMany(keys, 3, results);
+            for (int j = 0; j < 3; ++j) CHECK(results[j] == (model.count(keys[j]) == 1));
+        }
+        }
+
+        Key found;
+        auto above = model.lower_bound(key);
+        CHECK(tree.ceiling(key, found) == (above != model.end()) && (above == model.end() || found == *above));
+        auto below = model.upper_bound(key);
+        CHECK(tree.floor(key, found) == (below != model.begin()) && (below == model.begin() || found == *--below));
+
+        if (i % 1000 == 0)
+        {
+            std::vector<Key> walked;
+            for (auto &k : tree) walked.push_back(k);
+            CHECK(std::equal(walked.begin(), walked.end(), model.begin(), model.end()));
+        }
+    }
+
+    const int threads = 8, slots = 64;
+    Tree owned;
+    std::vector<std::vector<char>> models(threads, std::vector<char>(slots, 0));
+    runThreads(threads, [&](int t) {
+        std::mt19937 rng(2 + t);
+        for (int i = 0; i < 20000; ++i)
+        {
+            int slot = rng() % slots;
+            auto key = makeKey(slot * threads + t);
+            bool insert = rng() & 1;
+            if (insert) CHECK(owned.insert(key) != bool(models[t][slot]));
+            else CHECK(owned.remove(key) == bool(models[t][slot]));
+            models[t][slot] = insert;
+            CHECK(owned.contains(key) == insert);
+        }
+    });
+
+    std::set<Key, Compare> expected;
+    for (int k = 0; k < slots * threads; ++k)
+        if (models[k % threads][k / threads]) expected.insert(makeKey(k));
+    std::vector<Key> walked;
+    for (auto &k : owned) walked.push_back(k);
+    CHECK(std::equal(walked.begin(), walked.end(), expected.begin(), expected.end()));
+}
+
+std::string stringKey(int i)
+{
+    return std::string(24, 'k') + std::to_string(i);
+}
+
+int intKey(int i)
+{
+    return i;
+}
+
+template<typename T, typename Compare, typename Reclaimer, typename Ordering>
+using Tree = ConcurrentAVLTree<T, Reclaimer, SpinLock, Ordering, NoStats, PackedLayout, PoolAllocation, Compare>;
+
+int main()
+{
+    checkKeys<Tree<std::string, std::less<std::string>, EpochReclamation, LockedOrdering>, std::less<std::string>>(stringKey);
+    checkKeys<Tree<std::string, std::less<std::string>, HazardPointerReclamation, LockFreeOrdering>, std::less<std::string>>(stringKey);
+    checkKeys<Tree<int, std::greater<int>, EpochReclamation, LockedOrdering>, std::greater<int>>(intKey);
+    checkKeys<Tree<int, std::greater<int>, HazardPointerReclamation, LockFreeOrdering>, std::greater<int>>(intKey);
+    return report("GenericKeysTest");
+}
@@ -0,0 +1,80 @@
+#include "ConcurrentBST.h"
+#include "Test.h"
+
+/**
+* The hinted insert and find: one thread moves a hint in small steps, with now and then a jump, checking
+* each result against std::set, then plain removes behind the hint's back. Then threads each keep a hint
+* of their own over their own keys, as in checkOwnedKeys, while the others' inserts and removes land next
+* to the nodes those hints hold. */
+template<typename Tree>
+void checkHints()
+{
+    Tree tree;
+    std::set<int> model;
+    std::mt19937 rng(1);
+    auto hint = tree.hint();
+    int key = 0;
+    for (int i = 0; i < 50000; ++i)
+    {
+        key = rng() % 50 ? std::max(0, key + int(rng() % 9) - 3) % 4000 : int(rng() % 4000);
+        switch (rng() % 3)
+        {
+        case 0: CHECK(tree.insert(hint, key) == model.insert(key).second); break;
+        case 1: CHECK(tree.find(hint, key) == (model.count(key) == 1)); break;
+        default:
+        {
+            // removes go around the hint, which may be left on a removed node
+            int gone = std::max(0, key + int(rng() % 5) - 2);
+            CHECK(tree.remove(gone) == (model.erase(gone) == 1));
+        }
+        }
+    }
+    std::vector<int> walked;
+    for (auto &k : tree) walked.push_back(k);
+    CHECK(std::equal(walked.begin(), walked.end(), model.begin(), model.end()));
+    CHECK(tree.checkStructure());
+
+    const int threads = 8, slots = 256;
+    Tree owned;
+    std::vector<std::vector<char>> models(threads, std::vector<char>(slots, 0));
+    runThreads(threads, [&](int t) {
+        auto &mine = models[t];
+        auto hint = owned.hint();
+        std::mt19937 rng(2 + t);
+        int slot = 0;
+        for (int i = 0; i < 20000; ++i)
+        {
+            slot = (slot + int(rng() % 5) + slots - 1) % slots;
+            int key = slot * threads + t;
+            if (rng() & 1)
+            {
+                CHECK(owned.find(hint, key) == bool(mine[slot]));
+                continue;
+            }
+
+            bool insert = rng() & 1;
+            if (insert) CHECK(owned.insert(hint, key) != bool(mine[slot]));
+            else CHECK(owned.remove(key) == bool(mine[slot]));
+            mine[slot] = insert;
+        }
+    });
+
+    std::vector<int> expected;
+    walked.clear();
+    for (int k = 0; k < slots * threads; ++k)
+        if (models[k % threads][k / threads]) expected.push_back(k);
+    for (auto &k : owned) walked.push_back(k);
+    CHECK(walked == expected);
+    CHECK(owned.checkStructure());
+}
+
+int main()
+{
+    checkHints<ConcurrentAVLTree<int>>();
+    checkHints<ConcurrentAVLTree<int, HazardPointerReclamation>>();
+    checkHints<ConcurrentAVLTree<int, EpochReclamation, SpinLock, LockFreeOrdering>>();
+    checkHints<ConcurrentAVLTree<int, HazardPointerReclamation, SpinLock, LockFreeOrdering>>();
+    checkHints<ConcurrentAVLTree<int, EpochReclamation, SpinLock, LockedOrdering, NoStats, PackedLayout,
+                                 PoolAllocation, std::less<int>, AVLBalancing, TombstoneRemoval>>();
+    return report("HintTest");
+}
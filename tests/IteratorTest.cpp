@@ -0,0 +1,90 @@
+#include "ConcurrentBST.h"
+#include "Test.h"
+
+/**
+* Iterators and range: from(key) must start where std::set::lower_bound does and step both ways as the
+* set does, and range(lo, hi) must report the set's keys in [lo, hi]. Then walks from random keys and
+* range calls go on while threads insert and remove odd keys around them: every even key, which nobody
+* touches, must be reported, and the keys must come strictly ordered. */
+template<typename Tree>
+void checkIterators()
+{
+    Tree tree;
+    std::set<int> model;
+    std::mt19937 rng(1);
+    for (int i = 0; i < 20000; ++i)
+    {
+        int key = rng() % 500;
+        if (rng() % 3) CHECK(tree.insert(key) == model.insert(key).second);
+        else CHECK(tree.remove(key) == (model.erase(key) == 1));
+
+        int probe = rng() % 520 - 10;
+        auto expected = model.lower_bound(probe);
+        auto it = tree.from(probe);
+        for (int step = 0; step < 8 && expected != model.end(); ++step, ++it, ++expected)
+            CHECK(it.valid() && *it == *expected);
+        if (expected == model.end()) CHECK(!it.valid());
+
+        // and back again from where lower_bound points
+        auto back = tree.from(probe);
+        auto before = model.lower_bound(probe);
+        if (back.valid())
+        {
+            for (int step = 0; step < 8 && before != model.begin(); ++step)
+            {
+                --back;
+                --before;
+                CHECK(back.valid() && *back == *before);
+            }
+        }
+
+        int lo = rng() % 500, hi = lo + rng() % 64;
+        std::vector<int> found;
+        tree.range(lo, hi, [&](int k) { found.push_back(k); });
+        CHECK(std::equal(found.begin(), found.end(), model.lower_bound(lo), model.upper_bound(hi)));
+    }
+
+    // even keys stay put, odd keys come and go
+    Tree walked;
+    for (int k = 0; k < 512; k += 2) walked.insert(k);
+    runThreads(6, [&](int t) {
+        std::mt19937 rng(3 + t);
+        for (int i = 0; i < 10000; ++i)
+        {
+            if (t >= 3)
+            {
+                int key = 2 * (rng() % 256) + 1;
+                if (rng() & 1) walked.insert(key);
+                else walked.remove(key);
+                continue;
+            }
+
+            int lo = rng() % 512, hi = lo + rng() % 128, previous = lo - 1, evens = 0;
+            if (t == 0)
+                for (auto it = walked.from(lo); it.valid() && *it <= hi; ++it)
+                {
+                    CHECK(previous < *it);
+                    previous = *it;
+                    evens += *it % 2 == 0;
+                }
+            else
+                walked.range(lo, hi, [&](int k) {
+                    CHECK(previous < k);
+                    previous = k;
+                    evens += k % 2 == 0;
+                });
+            CHECK(evens == std::min(hi, 511) / 2 - (lo + 1) / 2 + 1);
+        }
+    });
+}
+
+int main()
+{
+    checkIterators<ConcurrentAVLTree<int>>();
+    checkIterators<ConcurrentAVLTree<int, HazardPointerReclamation>>();
+    checkIterators<ConcurrentAVLTree<int, EpochReclamation, SpinLock, LockFreeOrdering>>();
+    checkIterators<ConcurrentAVLTree<int, HazardPointerReclamation, SpinLock, LockFreeOrdering>>();
+    checkIterators<ConcurrentAVLTree<int, EpochReclamation, SpinLock, LockedOrdering, NoStats, PackedLayout,
+                                     PoolAllocation, std::less<int>, AVLBalancing, TombstoneRemoval>>();
+    return report("IteratorTest");
+}
@@ -0,0 +1,58 @@
+#include "ConcurrentBST.h"
+#include "Test.h"
+
+/**
+* LockFreeOrdering under each reclamation policy and both balancings: the std::set comparison, the
+* owned-key check, and walks in both directions while threads insert and remove around them. A walk
+* must come out strictly ordered and report every key that no thread touches during it. */
+template<typename Tree>
+void checkLockFree()
+{
+    checkAgainstSet<Tree>(50000, 200, 1);
+
+    Tree owned;
+    checkOwnedKeys(owned, 8, 64, 50000, 2);
+
+    // even keys stay put, odd keys come and go
+    Tree walked;
+    for (int k = 0; k < 256; k += 2) walked.insert(k);
+    runThreads(6, [&](int t) {
+        std::mt19937 rng(3 + t);
+        for (int i = 0; i < 20000; ++i)
+        {
+            if (t >= 2)
+            {
+                int key = 2 * (rng() % 128) + 1;
+                if (rng() & 1) walked.insert(key);
+                else walked.remove(key);
+                continue;
+            }
+
+            int previous = t == 0 ? -1 : 256, evens = 0;
+            if (t == 0)
+                for (auto &k : walked)
+                {
+                    CHECK(previous < k);
+                    previous = k;
+                    evens += k % 2 == 0;
+                }
+            else
+                for (auto it = walked.last(); it.valid(); --it)
+                {
+                    CHECK(*it < previous);
+                    previous = *it;
+                    evens += *it % 2 == 0;
+                }
+            CHECK(evens == 128);
+        }
+    });
+}
+
+int main()
+{
+    checkLockFree<ConcurrentAVLTree<int, NoReclamation, SpinLock, LockFreeOrdering>>();
+    checkLockFree<ConcurrentAVLTree<int, EpochReclamation, SpinLock, LockFreeOrdering>>();
+    checkLockFree<ConcurrentAVLTree<int, HazardPointerReclamation, SpinLock, LockFreeOrdering>>();
+    checkLockFree<ConcurrentBST<int, EpochReclamation, SpinLock, LockFreeOrdering>>();
+    return report("LockFreeOrderingTest");
+}
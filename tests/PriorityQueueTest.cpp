@@ -0,0 +1,82 @@
+#include <stdexcept>
+
+#include "Benchmark.h"
+#include "ConcurrentBST.h"
+#include "Test.h"
+
+/**
+* popMin and popMax: one thread against std::set, sprayed pops included, then threads popping a prefilled
+* tree empty, which must hand every key to exactly one of them. Last the benchmark's queue mode, the hold
+* model, which must run, and must stop with std::overflow_error rather than wrap once its priorities
+* outgrow int. */
+template<typename Tree>
+void checkPops()
+{
+    Tree tree;
+    std::set<int> model;
+    std::mt19937 rng(1);
+    for (int i = 0; i < 50000; ++i)
+    {
+        int key = rng() % 1000, found = -1;
+        std::size_t spray = rng() % 3 == 0 ? 8 : 1;
+        switch (rng() % 3)
+        {
+        case 0: CHECK(tree.insert(key) == model.insert(key).second); break;
+        case 1:
+            CHECK(tree.popMin(found, spray) == !model.empty());
+            if (model.empty()) break;
+            // a sprayed pop takes one of the spray least keys
+            CHECK(model.count(found) == 1 && std::distance(model.begin(), model.find(found)) < std::ptrdiff_t(spray));
+            model.erase(found);
+            break;
+        default:
+            CHECK(tree.popMax(found, spray) == !model.empty());
+            if (model.empty()) break;
+            CHECK(model.count(found) == 1 && std::distance(model.find(found), model.end()) <= std::ptrdiff_t(spray));
+            model.erase(found);
+        }
+    }
+
+    const int threads = 8, keys = 40000;
+    Tree shared;
+    for (int k = 0; k < keys; ++k) shared.insert(k);
+    std::vector<std::vector<int>> popped(threads);
+    runThreads(threads, [&](int t) {
+        int key;
+        while (shared.popMin(key, t % 2 ? threads : 1))
+            popped[t].push_back(key);
+    });
+    std::vector<int> all;
+    for (int t = 0; t < threads; ++t)
+    {
+        // with nothing inserted meanwhile, unsprayed pops only ever find a greater least key
+        if (t % 2 == 0) CHECK(std::is_sorted(popped[t].begin(), popped[t].end()));
+        all.insert(all.end(), popped[t].begin(), popped[t].end());
+    }
+    std::sort(all.begin(), all.end());
+    CHECK(all.size() == std::size_t(keys) && std::adjacent_find(all.begin(), all.end()) == all.end());
+
+    BenchmarkOptions options;
+    options.num_ops = 200000;
+    options.num_runs = 1;
+    options.num_warmup_runs = 0;
+    auto result = runBenchmark<Tree>("queue", options, UNIFORM, QUEUE_MODE, 4);
+    CHECK(result.samples.size() == 1 && result.ops_per_sec > 0);
+
+    // 32 keys queued over a 64K range climb about a thousand priorities per pop, past 2^25 within 40K pops
+    options.prefill = 0.0005;
+    options.num_ops = 2000000;
+    bool overflowed = false;
+    try { runBenchmark<Tree>("queue", options, UNIFORM, QUEUE_MODE, 2); }
+    catch (const std::overflow_error &) { overflowed = true; }
+    CHECK(overflowed);
+}
+
+int main()
+{
+    checkPops<ConcurrentAVLTree<int>>();
+    checkPops<ConcurrentAVLTree<int, HazardPointerReclamation, SpinLock, LockFreeOrdering>>();
+    checkPops<ConcurrentAVLTree<int, EpochReclamation, SpinLock, LockedOrdering, NoStats, PackedLayout, PoolAllocation,
+                                std::less<int>, AVLBalancing, TombstoneRemoval>>();
+    return report("PriorityQueueTest");
+}
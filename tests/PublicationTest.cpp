@@ -0,0 +1,56 @@
+#include "ConcurrentBST.h"
+#include "Test.h"
+
+/**
+* A key whose insert has returned must be visible to any thread that has heard so. Writers insert keys
+* of their own in order and after each one release a count of how far they have got; readers acquire a
+* count and look for one of the keys it covers through every read path. Under make test-tsan the same
+* run also checks that nothing in the tree is read without the ordering that publishes it. */
+template<typename Tree>
+void checkPublication(int writers, int readers, int keys)
+{
+    Tree tree;
+    std::vector<std::atomic<int>> published(writers);
+    for (auto &count : published) count.store(0);
+
+    runThreads(writers + readers, [&](int t) {
+        if (t < writers)
+        {
+            for (int i = 0; i < keys; ++i)
+            {
+                // an insert and remove of a key next to it keeps links changing around the new one
+                tree.insert(2 * (i * writers + t));
+                tree.insert(2 * (i * writers + t) + 1);
+                tree.remove(2 * (i * writers + t) + 1);
+                published[t].store(i + 1, std::memory_order_release);
+            }
+            return;
+        }
+
+        std::mt19937 rng(t);
+        while (published[writers - 1].load(std::memory_order_acquire) < keys)
+        {
+            int writer = rng() % writers, count = published[writer].load(std::memory_order_acquire);
+            if (count == 0) continue;
+
+            int key = 2 * ((rng() % count) * writers + writer), found = -1;
+            CHECK(tree.contains(key));
+            bool result;
+            tree.containsMany(&key, 1, &result);
+            CHECK(result);
+            CHECK(tree.ceiling(key, found) && found == key);
+            CHECK(tree.floor(key, found) && found == key);
+            auto it = tree.from(key);
+            CHECK(it.valid() && *it == key);
+        }
+    });
+}
+
+int main()
+{
+    checkPublication<ConcurrentAVLTree<int, EpochReclamation>>(3, 3, 20000);
+    checkPublication<ConcurrentAVLTree<int, HazardPointerReclamation>>(3, 3, 20000);
+    checkPublication<ConcurrentAVLTree<int, EpochReclamation, SpinLock, LockFreeOrdering>>(3, 3, 20000);
+    checkPublication<ConcurrentAVLTree<int, HazardPointerReclamation, SpinLock, LockFreeOrdering>>(3, 3, 20000);
+    return report("PublicationTest");
+}
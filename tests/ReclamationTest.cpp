@@ -0,0 +1,44 @@
+#include "ConcurrentBST.h"
+#include "Test.h"
+
+/**
+* Every reclamation policy under the same churn: threads insert and remove a small range of shared keys
+* while others walk the tree, so nodes are retired while readers may still be standing on them. A node
+* freed too early shows up as a crash, a walk out of order, or, built by make test-asan, a use after free. */
+template<typename Reclaimer>
+void checkReclaimer()
+{
+    typedef ConcurrentAVLTree<int, Reclaimer> Tree;
+    checkAgainstSet<Tree>(50000, 200, 1);
+
+    Tree owned;
+    checkOwnedKeys(owned, 8, 64, 50000, 2);
+
+    Tree shared;
+    runThreads(8, [&](int t) {
+        std::mt19937 rng(3 + t);
+        for (int i = 0; i < 50000; ++i)
+        {
+            int key = rng() % 64;
+            if (t % 4 == 0)
+            {
+                int previous = -1;
+                for (auto &k : shared)
+                {
+                    CHECK(previous < k);
+                    previous = k;
+                }
+            }
+            else if (rng() & 1) shared.insert(key);
+            else shared.remove(key);
+        }
+    });
+}
+
+int main()
+{
+    checkReclaimer<NoReclamation>();
+    checkReclaimer<EpochReclamation>();
+    checkReclaimer<HazardPointerReclamation>();
+    return report("ReclamationTest");
+}
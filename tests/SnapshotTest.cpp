@@ -0,0 +1,109 @@
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+
+#include "ConcurrentBST.h"
+#include "Test.h"
+
+/**
+* saveSnapshot and loadSnapshot: trees of 0 to 20000 keys must come back from their files the same, loaded
+* on one thread and on several. Saves taken while threads insert and remove odd keys must hold every even
+* key, which nobody touches, strictly ascending, as many as saveSnapshot reported. Files that are missing,
+* cut short, carry the wrong magic or were written with another key size must throw std::runtime_error. */
+std::string snapshotPath(const char *name)
+{
+    return "/tmp/SnapshotTest." + std::to_string(::getpid()) + "." + name;
+}
+
+template<typename Tree>
+bool loadFails(const std::string &path)
+{
+    Tree tree;
+    try { tree.loadSnapshot(path); }
+    catch (const std::runtime_error &) { return !tree.begin().valid(); }
+    return false;
+}
+
+template<typename Tree>
+void checkSnapshots()
+{
+    auto path = snapshotPath("keys");
+    for (int n : {0, 1, 2, 1000, 4096, 20000})
+    {
+        Tree tree;
+        std::vector<int> keys;
+        std::mt19937 rng(n);
+        for (int i = 0; i < n; ++i) tree.insert(int(rng() % (4 * n)) - n);
+        for (auto &k : tree) keys.push_back(k);
+        CHECK(tree.saveSnapshot(path) == keys.size());
+
+        for (unsigned threads : {1u, 8u})
+        {
+            Tree loaded;
+            CHECK(loaded.loadSnapshot(path, threads) == keys.size());
+            std::vector<int> walked;
+            for (auto &k : loaded) walked.push_back(k);
+            CHECK(walked == keys);
+            CHECK(loaded.checkStructure());
+        }
+    }
+
+    Tree changing;
+    for (int k = 0; k < 8192; k += 2) changing.insert(k);
+    std::atomic<bool> stop{false};
+    std::thread saver([&] {
+        for (int i = 0; i < 20; ++i)
+        {
+            auto count = changing.saveSnapshot(path);
+            Tree loaded;
+            // loading would throw if the keys were not strictly ascending
+            CHECK(loaded.loadSnapshot(path) == count);
+            std::size_t evens = 0;
+            for (auto &k : loaded) evens += k % 2 == 0;
+            CHECK(evens == 4096);
+        }
+        stop.store(true);
+    });
+    runThreads(4, [&](int t) {
+        std::mt19937 rng(t);
+        while (!stop.load())
+        {
+            int key = 2 * (rng() % 4096) + 1;
+            if (rng() & 1) changing.insert(key);
+            else changing.remove(key);
+        }
+    });
+    saver.join();
+
+    // damaged copies of the last save
+    std::ifstream in(path, std::ios::binary);
+    std::string bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    auto damaged = snapshotPath("damaged");
+    auto write = [&](const std::string &contents) { std::ofstream(damaged, std::ios::binary) << contents; };
+
+    write(bytes.substr(0, bytes.size() - 1));
+    CHECK(loadFails<Tree>(damaged));
+    write(bytes.substr(0, 10));
+    CHECK(loadFails<Tree>(damaged));
+    auto bad_magic = bytes;
+    bad_magic[0] ^= 1;
+    write(bad_magic);
+    CHECK(loadFails<Tree>(damaged));
+    write(bytes);
+    CHECK(loadFails<ConcurrentAVLTree<long>>(damaged));
+    CHECK(loadFails<Tree>(snapshotPath("missing")));
+
+    std::remove(path.c_str());
+    std::remove(damaged.c_str());
+}
+
+int main()
+{
+    checkSnapshots<ConcurrentAVLTree<int>>();
+    checkSnapshots<ConcurrentAVLTree<int, HazardPointerReclamation, SpinLock, LockFreeOrdering>>();
+    checkSnapshots<ConcurrentAVLTree<int, EpochReclamation, SpinLock, LockedOrdering, NoStats, PackedLayout,
+                                     PoolAllocation, std::less<int>, AVLBalancing, TombstoneRemoval>>();
+    return report("SnapshotTest");
+}
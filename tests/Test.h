@@ -0,0 +1,136 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdio>
+#include <random>
+#include <set>
+#include <thread>
+#include <vector>
+
+/**
+* The few helpers the tests under tests/ share. Each test is a program of its own: it runs its checks,
+* prints each mismatch with where it was found, and exits non-zero if there was any (see make test). */
+
+inline std::atomic<long>& failures()
+{
+    static std::atomic<long> count{0};
+    return count;
+}
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond) && failures().fetch_add(1, std::memory_order_relaxed) < 20) \
+            std::printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+    } while (0)
+
+inline int report(const char *test)
+{
+    long count = failures().load();
+    if (count) std::printf("%s: %ld failure(s)\n", test, count);
+    else std::printf("%s: ok\n", test);
+    return count != 0;
+}
+
+template<typename Body>
+void runThreads(int threads, Body body)
+{
+    std::vector<std::thread> pool;
+    for (int t = 0; t < threads; ++t)
+        pool.emplace_back(body, t);
+    for (auto &thread : pool)
+        thread.join();
+}
+
+/**
+* Random single-threaded operations on keys in [0, range), checked one by one against std::set: the
+* results of insert, remove, contains, containsMany and the nearest-key queries, and both walk
+* directions every so often. */
+template<typename Tree>
+void checkAgainstSet(int ops, int range, unsigned seed)
+{
+    Tree tree;
+    std::set<int> model;
+    std::mt19937 rng(seed);
+
+    for (int i = 0; i < ops; ++i)
+    {
+        int key = rng() % range;
+        switch (rng() % 4)
+        {
+        case 0: CHECK(tree.insert(key) == model.insert(key).second); break;
+        case 1: CHECK(tree.remove(key) == (model.erase(key) == 1)); break;
+        case 2: CHECK(tree.contains(key) == (model.count(key) == 1)); break;
+        default:
+        {
+            int keys[4];
+            bool results[4];
+            for (auto &k : keys) k = rng() % range;
+            tree.containsMany(keys, 4, results);
+            for (int j = 0; j < 4; ++j) CHECK(results[j] == (model.count(keys[j]) == 1));
+        }
+        }
+
+        int found;
+        auto above = model.lower_bound(key);
+        CHECK(tree.ceiling(key, found) == (above != model.end()) && (above == model.end() || found == *above));
+        auto below = model.upper_bound(key);
+        CHECK(tree.floor(key, found) == (below != model.begin()) && (below == model.begin() || found == *--below));
+
+        if (i % 1000 == 0)
+        {
+            std::vector<int> forward, backward;
+            for (auto &k : tree) forward.push_back(k);
+            for (auto it = tree.last(); it.valid(); --it) backward.push_back(*it);
+            std::reverse(backward.begin(), backward.end());
+            CHECK(std::equal(forward.begin(), forward.end(), model.begin(), model.end()));
+            CHECK(forward == backward);
+        }
+    }
+}
+
+/**
+* threads threads update the tree at once, each only on keys of its own, k * threads + t for k in
+* [0, slots): so every key has neighbours that other threads are changing, but only its owner ever
+* changes it, and the owner knows exactly what contains and containsMany must say about it. Once they
+* have all finished, a walk must find exactly the keys the owners left in. */
+template<typename Tree>
+void checkOwnedKeys(Tree &tree, int threads, int slots, int ops, unsigned seed)
+{
+    std::vector<std::vector<char>> models(threads, std::vector<char>(slots, 0));
+    for (auto &k : tree)
+        models[k % threads][k / threads] = 1;
+
+    runThreads(threads, [&](int t) {
+        auto &model = models[t];
+        std::mt19937 rng(seed + t);
+        for (int i = 0; i < ops; ++i)
+        {
+            int slot = rng() % slots, key = slot * threads + t;
+            bool insert = rng() & 1;
+            if (insert) CHECK(tree.insert(key) != bool(model[slot]));
+            else CHECK(tree.remove(key) == bool(model[slot]));
+            model[slot] = insert;
+
+            int probe = rng() % slots;
+            CHECK(tree.contains(probe * threads + t) == bool(model[probe]));
+
+            int keys[4], probes[4];
+            bool results[4];
+            for (int j = 0; j < 4; ++j)
+            {
+                probes[j] = rng() % slots;
+                keys[j] = probes[j] * threads + t;
+            }
+            tree.containsMany(keys, 4, results);
+            for (int j = 0; j < 4; ++j) CHECK(results[j] == bool(model[probes[j]]));
+        }
+    });
+
+    std::vector<int> expected, found;
+    for (int k = 0; k < slots * threads; ++k)
+        if (models[k % threads][k / threads]) expected.push_back(k);
+    for (auto &k : tree) found.push_back(k);
+    CHECK(found == expected);
+}
@@ -0,0 +1,44 @@
+#include "ConcurrentBST.h"
+#include "Test.h"
+
+/**
+* TombstoneRemoval: removes leave nodes in place, inserts revive them, and purges unlink them while both
+* go on. A thread purging all the time keeps searches and containsMany walks landing on nodes that are
+* just leaving the list, which is where a walk once skipped a key inserted next to one. Afterwards a
+* purge must leave no tombstone behind and the walk the keys the owners left in. */
+template<typename Tree>
+void checkTombstones()
+{
+    checkAgainstSet<Tree>(50000, 200, 1);
+
+    for (double ratio : {0.0, 0.25, 4.0})
+    {
+        Tree tree;
+        tree.setPurgeRatio(ratio);
+
+        std::atomic<bool> done{false};
+        std::thread purger([&] {
+            while (!done.load()) tree.purge();
+        });
+        checkOwnedKeys(tree, 8, 64, 40000, 2);
+        done.store(true);
+        purger.join();
+
+        tree.purge();
+        CHECK(tree.tombstones() == 0);
+        checkOwnedKeys(tree, 8, 64, 10000, 3);
+    }
+}
+
+template<typename Reclaimer, typename Balancing, typename Backoff = YieldBackoff>
+using TombstoneTree = ConcurrentAVLTree<int, Reclaimer, SpinLock, LockedOrdering, NoStats, PackedLayout, PoolAllocation,
+                                        std::less<int>, Balancing, TombstoneRemoval, Backoff>;
+
+int main()
+{
+    checkTombstones<TombstoneTree<EpochReclamation, AVLBalancing>>();
+    checkTombstones<TombstoneTree<HazardPointerReclamation, AVLBalancing>>();
+    checkTombstones<TombstoneTree<EpochReclamation, NoBalancing, ParkingBackoff>>();
+    checkTombstones<TombstoneTree<EpochReclamation, DeferredBalancing>>();
+    return report("TombstoneTest");
+}